@@ -43,7 +43,7 @@ int io_atom_read(struct io_poller *poller, io_atom *io, char *buf, size_t cnt, s
 	*readlen = 0;
     do {
         len = read(io->fd, buf, cnt);
-    } while (errno == EINTR);   // stupid posix
+    } while (len < 0 && errno == EINTR);   // stupid posix
 
     if(len > 0) {
         // success!
@@ -71,7 +71,7 @@ int io_atom_readv(struct io_poller *poller, io_atom *io, const struct iovec *vec
 	*readlen = 0;
     do {
         len = readv(io->fd, vec, cnt);
-    } while (errno == EINTR);   // stupid posix
+    } while (len < 0 && errno == EINTR);   // stupid posix
 
     if(len > 0) {
         // success!
@@ -118,7 +118,7 @@ int io_atom_write(struct io_poller *poller, io_atom *io, const char *buf, size_t
     *wrlen = 0;
     do {
         len = write(io->fd, buf, cnt);
-    } while(errno == EINTR);
+    } while(len < 0 && errno == EINTR);
 
     if(len > 0) {
         *wrlen = len;
@@ -144,7 +144,7 @@ int io_atom_writev(struct io_poller *poller, io_atom *io, const struct iovec *ve
     *wrlen = 0;
     do {
         len = writev(io->fd, vec, cnt);
-    } while(errno == EINTR);
+    } while(len < 0 && errno == EINTR);
 
     if(len > 0) {
         *wrlen = len;
@@ -93,6 +93,7 @@ typedef void (*io_proc)(struct io_poller *poller, struct io_atom *atom);
 struct io_atom {
 	io_proc read_proc;	///< The function to call when there is a read event on the fd.
 	io_proc write_proc;	///< Function to call when there is a write event on the fd.
+	io_proc error_proc;	///< Called when the fd reports an error (see below).  Usually NULL.
 	int fd;         	///< The fd to watch for events.
 };
 typedef struct io_atom io_atom;
@@ -108,7 +109,21 @@ typedef struct io_atom io_atom;
  * initialized struct and have to spend a fair amount of debug time
  * trying to figure out what's going on.
  */
-#define io_atom_init(io,ff,ppr,ppw) ((io)->fd=(ff),(io)->read_proc=(ppr),(io)->write_proc=(ppw))
+#define io_atom_init(io,ff,ppr,ppw) ((io)->fd=(ff),(io)->read_proc=(ppr),(io)->write_proc=(ppw),(io)->error_proc=NULL)
+
+
+/** Asks for the atom's error_proc to be called when its fd has an error
+ *  pending, such as MSG_ZEROCOPY completions on the socket's error queue.
+ *
+ * Without an error_proc, errors are reported by calling the read or
+ * write proc and letting the read or write fail.  With one, a pending
+ * error calls the error_proc first.  It must clear the error (by
+ * reading the error queue or SO_ERROR) or level-triggered pollers will
+ * keep calling it.  It must not close the atom; leave that to the read
+ * or write proc.  Only pollers with IO_CAP_ERROR_PROC call it (select
+ * can't tell errors from readiness).
+ */
+#define io_atom_set_error_proc(io,ppe) ((io)->error_proc=(ppe))
 
 
 /** Reads data from a file or socket.
@@ -0,0 +1,330 @@
+/** @file bufpool.c
+ *
+ * Slab allocated, reference counted buffers with per-thread free lists.
+ * See bufpool.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "poller.h"
+#include "bufpool.h"
+
+
+// A thread's free buffers for one pool.  The pool's id is checked as
+// well as its address so a cache left over from a disposed pool is
+// never mistaken for a new pool at the same address.
+
+struct bufcache {
+	io_bufpool *pool;
+	unsigned long id;
+	io_buf *free;
+	unsigned count;
+};
+
+static __thread struct bufcache caches[IO_BUFPOOL_CACHES];
+
+static unsigned long next_pool_id;
+
+
+// Returns this thread's cache for the pool, claiming an empty slot
+// if there isn't one yet.  Returns NULL if every slot is taken.
+
+static struct bufcache* find_cache(io_bufpool *pool)
+{
+	struct bufcache *empty = NULL;
+	int i;
+
+	for(i=0; i<IO_BUFPOOL_CACHES; i++) {
+		if(caches[i].pool == pool && caches[i].id == pool->id) {
+			return &caches[i];
+		}
+		if(!empty && (!caches[i].pool || !caches[i].count)) {
+			empty = &caches[i];
+		}
+	}
+
+	if(empty) {
+		empty->pool = pool;
+		empty->id = pool->id;
+		empty->free = NULL;
+		empty->count = 0;
+	}
+	return empty;
+}
+
+
+// Rounds the size of each buffer up so their headers stay aligned.
+
+static size_t buf_stride(io_bufpool *pool)
+{
+	size_t align = sizeof(void*) * 2;
+	return (sizeof(io_buf) + pool->buf_size + align - 1) & ~(align - 1);
+}
+
+
+// Allocates a slab and puts all of its buffers on the shared list.
+// The first pointer-sized bytes of a slab link it to the next one.
+// Must be called with the lock held.
+
+static int add_slab(io_bufpool *pool)
+{
+	size_t stride = buf_stride(pool);
+	size_t header = sizeof(void*) * 2;
+	char *slab;
+	io_buf *buf;
+	unsigned i;
+
+	slab = malloc(header + stride * pool->per_slab);
+	if(!slab) {
+		return ENOMEM;
+	}
+
+	*(void**)slab = pool->slabs;
+	pool->slabs = slab;
+
+	for(i=0; i<pool->per_slab; i++) {
+		buf = (io_buf*)(slab + header + i*stride);
+		buf->pool = pool;
+		buf->data = (char*)(buf + 1);
+		buf->chunk.next = (io_outq_chunk*)pool->free;
+		pool->free = buf;
+	}
+	pool->free_count += pool->per_slab;
+
+	return 0;
+}
+
+
+int io_bufpool_init(io_bufpool *pool, size_t buf_size, unsigned per_slab)
+{
+	if(!buf_size || !per_slab) {
+		return EINVAL;
+	}
+
+	pool->buf_size = buf_size;
+	pool->per_slab = per_slab;
+	pool->id = __atomic_add_fetch(&next_pool_id, 1, __ATOMIC_RELAXED);
+	pool->slabs = NULL;
+	pool->free = NULL;
+	pool->free_count = 0;
+
+	return pthread_mutex_init(&pool->lock, NULL);
+}
+
+
+void io_bufpool_dispose(io_bufpool *pool)
+{
+	struct bufcache *cache;
+	void *slab, *next;
+	int i;
+
+	// forget this thread's cache.  Other threads' caches will see
+	// that the id doesn't match.
+	for(i=0; i<IO_BUFPOOL_CACHES; i++) {
+		cache = &caches[i];
+		if(cache->pool == pool) {
+			cache->pool = NULL;
+			cache->free = NULL;
+			cache->count = 0;
+		}
+	}
+
+	for(slab=pool->slabs; slab; slab=next) {
+		next = *(void**)slab;
+		free(slab);
+	}
+	pool->slabs = NULL;
+	pool->free = NULL;
+	pool->free_count = 0;
+
+	pthread_mutex_destroy(&pool->lock);
+}
+
+
+// Moves a batch of buffers from the shared list to the cache.
+
+static int refill(io_bufpool *pool, struct bufcache *cache)
+{
+	io_buf *buf;
+	int err = 0;
+	unsigned i;
+
+	pthread_mutex_lock(&pool->lock);
+	if(pool->free_count < IO_BUFPOOL_BATCH) {
+		err = add_slab(pool);
+	}
+	for(i=0; i<IO_BUFPOOL_BATCH && (buf = pool->free); i++) {
+		pool->free = (io_buf*)buf->chunk.next;
+		pool->free_count -= 1;
+		buf->chunk.next = (io_outq_chunk*)cache->free;
+		cache->free = buf;
+		cache->count += 1;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return cache->free ? 0 : (err ? err : ENOMEM);
+}
+
+
+// Moves a batch of buffers from the cache back to the shared list.
+
+static void drain(io_bufpool *pool, struct bufcache *cache)
+{
+	io_buf *buf;
+	unsigned i;
+
+	pthread_mutex_lock(&pool->lock);
+	for(i=0; i<IO_BUFPOOL_BATCH && (buf = cache->free); i++) {
+		cache->free = (io_buf*)buf->chunk.next;
+		cache->count -= 1;
+		buf->chunk.next = (io_outq_chunk*)pool->free;
+		pool->free = buf;
+		pool->free_count += 1;
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+
+io_buf* io_buf_alloc(io_bufpool *pool)
+{
+	struct bufcache *cache = find_cache(pool);
+	struct bufcache single = { pool, pool->id, NULL, 0 };
+	io_buf *buf;
+
+	if(!cache) {
+		cache = &single;
+	}
+
+	if(!cache->free && refill(pool, cache)) {
+		return NULL;
+	}
+
+	buf = cache->free;
+	cache->free = (io_buf*)buf->chunk.next;
+	cache->count -= 1;
+
+	if(cache == &single && cache->free) {
+		// no room to cache the rest of the batch on this thread.
+		drain(pool, cache);
+	}
+
+	buf->refs = 1;
+	buf->queued = 0;
+	buf->len = 0;
+	return buf;
+}
+
+
+void io_buf_ref(io_buf *buf)
+{
+	__atomic_add_fetch(&buf->refs, 1, __ATOMIC_RELAXED);
+}
+
+
+void io_buf_unref(io_buf *buf)
+{
+	io_bufpool *pool = buf->pool;
+	struct bufcache *cache;
+
+	if(__atomic_sub_fetch(&buf->refs, 1, __ATOMIC_ACQ_REL) > 0) {
+		return;
+	}
+
+	cache = find_cache(pool);
+	if(!cache) {
+		pthread_mutex_lock(&pool->lock);
+		buf->chunk.next = (io_outq_chunk*)pool->free;
+		pool->free = buf;
+		pool->free_count += 1;
+		pthread_mutex_unlock(&pool->lock);
+		return;
+	}
+
+	buf->chunk.next = (io_outq_chunk*)cache->free;
+	cache->free = buf;
+	cache->count += 1;
+
+	// hand buffers back so a thread that only frees (the consumer
+	// end of a pipeline) doesn't hoard them.
+	if(cache->count >= 2*IO_BUFPOOL_BATCH) {
+		drain(pool, cache);
+	}
+}
+
+
+int io_buf_read(io_poller *poller, io_atom *atom, io_buf *buf)
+{
+	size_t len;
+	int err;
+
+	if(buf->len >= buf->pool->buf_size) {
+		return ENOBUFS;
+	}
+
+	err = io_read(poller, atom, buf->data + buf->len, buf->pool->buf_size - buf->len, &len);
+	if(!err) {
+		buf->len += len;
+	}
+	return err;
+}
+
+
+static void release_queued(io_outq_chunk *chunk)
+{
+	io_buf *buf = (io_buf*)chunk;
+
+	buf->queued = 0;
+	io_buf_unref(buf);
+}
+
+
+// Returns the buffer at the end of the queue if buf's data can be
+// copied into it.  Its only reference must be the queue's so nobody
+// else can be reading into or looking at its free space.
+
+static io_buf* copy_target(io_outq *q, io_buf *buf)
+{
+	io_outq_chunk *last = io_outq_last(q);
+	io_buf *tail;
+
+	if(!last || last->release != release_queued) {
+		return NULL;
+	}
+
+	tail = (io_buf*)last;
+	if(tail->pool != buf->pool || buf->len >= buf->pool->buf_size / IO_BUF_COPY_RATIO) {
+		return NULL;
+	}
+	if(buf->len > tail->pool->buf_size - tail->len) {
+		return NULL;
+	}
+	if(__atomic_load_n(&tail->refs, __ATOMIC_ACQUIRE) != 1) {
+		return NULL;
+	}
+
+	return tail;
+}
+
+
+int io_buf_queue(io_poller *poller, io_outq *q, io_buf *buf)
+{
+	io_buf *tail;
+
+	if(buf->queued) {
+		return EBUSY;
+	}
+
+	tail = copy_target(q, buf);
+	if(tail) {
+		memcpy(tail->data + tail->len, buf->data, buf->len);
+		tail->len += buf->len;
+		return io_outq_extend(poller, q, buf->len);
+	}
+
+	buf->queued = 1;
+	io_buf_ref(buf);
+	io_outq_init_chunk(&buf->chunk, buf->data, buf->len, release_queued);
+	return io_outq_append(poller, q, &buf->chunk);
+}
@@ -0,0 +1,129 @@
+/** @file bufpool.h
+ *
+ * A pool of fixed-size, reference counted buffers.
+ *
+ * Read straight into an io_buf, then hand the same buffer to one or
+ * more output queues without copying it.  The buffer goes back to the
+ * pool when the last reference is dropped, on whatever thread that
+ * happens to be.
+ *
+ * Buffers are allocated a slab at a time and never returned to the
+ * system until the pool is disposed.  Each thread keeps its own free
+ * list so allocating and freeing normally takes no locks.  The pool's
+ * shared list is only touched (under a mutex) when a thread's list
+ * runs dry or grows too long.
+ *
+ *		io_bufpool pool;
+ *		io_bufpool_init(&pool, 16384, 64);
+ *
+ *		io_buf *buf = io_buf_alloc(&pool);
+ *		err = io_buf_read(poller, &conn->io, buf);
+ *		if(!err) io_buf_queue(poller, &peer->outq, buf);
+ *		io_buf_unref(buf);
+ */
+
+#ifndef IO_BUFPOOL_H
+#define IO_BUFPOOL_H
+
+#include <pthread.h>
+#include "outq.h"
+
+
+/// The number of buffers moved between a thread's free list and the
+/// pool's shared list at a time.
+#ifndef IO_BUFPOOL_BATCH
+#define IO_BUFPOOL_BATCH 32
+#endif
+
+/// io_buf_queue copies data into the queue's last buffer, rather than
+/// queuing another buffer, if it's less than buf_size/IO_BUF_COPY_RATIO
+/// bytes.  This keeps the memory pinned by a queue within this many
+/// times the data it holds.
+#ifndef IO_BUF_COPY_RATIO
+#define IO_BUF_COPY_RATIO 8
+#endif
+
+/// The number of pools a thread can cache buffers for at once.
+/// A thread using more pools than this just takes the lock more often.
+#ifndef IO_BUFPOOL_CACHES
+#define IO_BUFPOOL_CACHES 4
+#endif
+
+
+struct io_bufpool;
+
+
+struct io_buf {
+	io_outq_chunk chunk;		///< used by io_buf_queue.  Also links free buffers.
+	struct io_bufpool *pool;
+	int refs;
+	int queued;					///< set while chunk is on an output queue.
+	char *data;					///< the buffer's storage, pool->buf_size bytes.
+	size_t len;					///< the number of valid bytes in data.
+};
+typedef struct io_buf io_buf;
+
+
+struct io_bufpool {
+	size_t buf_size;		///< the size of each buffer's data.
+	unsigned per_slab;		///< the number of buffers allocated at a time.
+	unsigned long id;		///< tells a thread's cache that this is the same pool it cached.
+
+	pthread_mutex_t lock;	///< protects everything below.
+	void *slabs;			///< every slab that has been allocated.
+	io_buf *free;			///< the shared free list.
+	unsigned free_count;
+};
+typedef struct io_bufpool io_bufpool;
+
+
+/** Prepares a pool of buffers with buf_size bytes of data each,
+ *  allocated per_slab buffers at a time.
+ */
+
+int io_bufpool_init(io_bufpool *pool, size_t buf_size, unsigned per_slab);
+
+
+/** Frees all the pool's memory.  Every buffer must have been released
+ *  and no other thread may be using the pool.
+ */
+
+void io_bufpool_dispose(io_bufpool *pool);
+
+
+/** Returns an empty buffer with a single reference, or NULL if out of memory. */
+
+io_buf* io_buf_alloc(io_bufpool *pool);
+
+/** Adds a reference to the buffer.  Safe from any thread. */
+
+void io_buf_ref(io_buf *buf);
+
+/** Drops a reference.  The buffer returns to its pool when the last
+ *  reference is dropped.  Safe from any thread.
+ */
+
+void io_buf_unref(io_buf *buf);
+
+
+/** Reads into the free space at the end of the buffer, adding to len.
+ *  Returns the same errors as io_read (ENOBUFS if the buffer is full).
+ */
+
+int io_buf_read(struct io_poller *poller, io_atom *atom, io_buf *buf);
+
+
+/** Queues the buffer's data on an output queue without copying it.
+ *
+ * The queue holds its own reference until the data has been written so
+ * you may drop yours right away.  Small amounts of data are copied into
+ * the free space in the buffer at the end of the queue instead, so a
+ * peer that trickles in a few bytes at a time doesn't pin a whole
+ * buffer per read.  A buffer can only be on one queue at
+ * a time (EBUSY); to send the same data to several queues, use your
+ * own io_outq_chunks pointing into buf->data.
+ */
+
+int io_buf_queue(struct io_poller *poller, io_outq *q, io_buf *buf);
+
+#endif
@@ -0,0 +1,130 @@
+// echobench.c
+//
+// Bounces small messages across a set of socketpairs, all on one
+// poller: the server end echoes whatever it reads and the client end
+// sends the next message as soon as the echo arrives.  This is almost
+// all io_read, io_write and dispatch, so it shows what the function
+// table costs.  The Makefile builds it twice:
+//
+//     make echobench
+//     ./echobench-dynamic		// through the function table
+//     ./echobench-static		// -DIO_STATIC_BACKEND=epoll -flto
+//
+// usage: echobench [pairs] [round trips]
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include "poller.h"
+
+
+#define MSG_SIZE 64
+
+typedef struct {
+	io_atom server;
+	io_atom client;
+	long remaining;
+} pair;
+
+static long round_trips;
+
+
+static void server_read_proc(io_poller *poller, io_atom *atom)
+{
+	char buf[MSG_SIZE];
+	size_t len, wlen;
+
+	while(io_read(poller, atom, buf, sizeof(buf), &len) == 0) {
+		io_write(poller, atom, buf, len, &wlen);
+	}
+}
+
+
+static void client_read_proc(io_poller *poller, io_atom *atom)
+{
+	pair *p = io_resolve_parent(atom, pair, client);
+	char buf[MSG_SIZE];
+	size_t len, wlen;
+
+	while(io_read(poller, atom, buf, sizeof(buf), &len) == 0) {
+		round_trips += 1;
+		if(--p->remaining > 0) {
+			io_write(poller, atom, buf, len, &wlen);
+		}
+	}
+}
+
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+int main(int argc, char **argv)
+{
+	io_poller poller;
+	pair *pairs;
+	int npairs = argc > 1 ? atoi(argv[1]) : 64;
+	long trips = argc > 2 ? atol(argv[2]) : 500000;
+	char msg[MSG_SIZE];
+	double start, elapsed;
+	size_t wlen;
+	int i, err, sv[2];
+
+	err = io_poller_init(&poller, IO_POLLER_EPOLL);
+	if(err) {
+		fprintf(stderr, "couldn't create epoll poller: %s\n", strerror(err));
+		exit(1);
+	}
+
+	pairs = calloc(npairs, sizeof(pair));
+	for(i=0; i<npairs; i++) {
+		if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv) < 0) {
+			perror("socketpair");
+			exit(1);
+		}
+		io_atom_init(&pairs[i].server, sv[0], server_read_proc, NULL);
+		io_atom_init(&pairs[i].client, sv[1], client_read_proc, NULL);
+		io_add(&poller, &pairs[i].server, IO_READ);
+		io_add(&poller, &pairs[i].client, IO_READ);
+		pairs[i].remaining = trips / npairs;
+	}
+
+	memset(msg, 'x', sizeof(msg));
+	start = now();
+	for(i=0; i<npairs; i++) {
+		io_write(&poller, &pairs[i].client, msg, sizeof(msg), &wlen);
+	}
+	while(round_trips < (trips / npairs) * npairs) {
+		io_wait(&poller, 1000);
+		io_dispatch(&poller);
+	}
+	elapsed = now() - start;
+
+	printf("%s: %s, %d pairs, %ld round trips in %.3f s, %.0f trips/s\n",
+#ifdef IO_STATIC_BACKEND
+			"static",
+#else
+			"dynamic",
+#endif
+			poller.poller_name, npairs, round_trips, elapsed, round_trips / elapsed);
+
+	for(i=0; i<npairs; i++) {
+		io_close(&poller, &pairs[i].server);
+		io_close(&poller, &pairs[i].client);
+	}
+	free(pairs);
+	io_poller_dispose(&poller);
+	return 0;
+}
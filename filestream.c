@@ -0,0 +1,96 @@
+/** @file filestream.c
+ *
+ * Sends file regions to sockets with sendfile.  See filestream.h.
+ */
+
+#include <unistd.h>
+#include <errno.h>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#include "poller.h"
+#include "filestream.h"
+
+
+void io_file_stream_init(io_file_stream *fs, int file_fd, off_t offset, off_t len, int *flags)
+{
+	fs->file_fd = file_fd;
+	fs->offset = offset;
+	fs->end = offset + len;
+	fs->flags = flags;
+}
+
+
+// Sends the next piece of the file.  Returns the number of bytes sent
+// or -1 with errno set, just like sendfile.
+
+static ssize_t send_piece(io_file_stream *fs, int sock, size_t cnt)
+{
+#ifdef __linux__
+	// sendfile advances fs->offset for us.
+	return sendfile(sock, fs->file_fd, &fs->offset, cnt);
+#else
+	char buf[16384];
+	ssize_t len, wlen;
+
+	if(cnt > sizeof(buf)) {
+		cnt = sizeof(buf);
+	}
+	len = pread(fs->file_fd, buf, cnt, fs->offset);
+	if(len <= 0) {
+		return len;
+	}
+	// whatever doesn't get written is simply read again next time.
+	wlen = write(sock, buf, len);
+	if(wlen > 0) {
+		fs->offset += wlen;
+	}
+	return wlen;
+#endif
+}
+
+
+int io_file_stream_send(io_poller *poller, io_atom *io, io_file_stream *fs)
+{
+	off_t remaining;
+	ssize_t len;
+	int want, err = 0;
+
+	while(!io_file_stream_done(fs)) {
+		remaining = io_file_stream_remaining(fs);
+		len = send_piece(fs, io->fd,
+				remaining < IO_FILE_STREAM_CHUNK ? remaining : IO_FILE_STREAM_CHUNK);
+
+		if(len > 0) {
+			continue;
+		}
+		if(len == 0) {
+			// the file is shorter than the region we were asked to send.
+			err = EIO;
+			break;
+		}
+		if(errno == EINTR) {
+			continue;
+		}
+		if(errno != EAGAIN && errno != EWOULDBLOCK) {
+			err = errno;
+		}
+		break;
+	}
+
+	if(err) {
+		return err;
+	}
+
+	// wait for room in the socket if there's more to send.
+	want = io_file_stream_done(fs) ? (*fs->flags & ~IO_WRITE) : (*fs->flags | IO_WRITE);
+	if(want != *fs->flags) {
+		err = io_set(poller, io, want);
+		if(!err) {
+			*fs->flags = want;
+		}
+	}
+	return err;
+}
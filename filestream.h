@@ -0,0 +1,76 @@
+/** @file filestream.h
+ *
+ * Streams part of a file to a socket.
+ *
+ * An io_file_stream sends a region of an open file to an atom with
+ * sendfile(2), so the data goes from the page cache to the socket
+ * without ever being copied into your process.  When the socket fills
+ * up the stream turns on IO_WRITE; call io_file_stream_send again from
+ * the atom's write proc and it picks up where it left off.  Once the
+ * whole region has been sent IO_WRITE is turned off again.
+ *
+ * A stream is just a few words of state and holds no buffers, so
+ * thousands of concurrent downloads cost almost nothing.  Many streams
+ * may share one file_fd since sendfile is given an explicit offset.
+ *
+ *		io_file_stream_init(&conn->fs, fd, 0, st.st_size, &conn->flags);
+ *		err = io_file_stream_send(poller, &conn->io, &conn->fs);
+ *		...
+ *		// in the write proc
+ *		err = io_file_stream_send(poller, &conn->io, &conn->fs);
+ *		if(!err && io_file_stream_done(&conn->fs)) ...
+ */
+
+#ifndef IO_FILESTREAM_H
+#define IO_FILESTREAM_H
+
+#include <sys/types.h>
+#include "atom.h"
+
+
+/// The most handed to a single sendfile call.
+#ifndef IO_FILE_STREAM_CHUNK
+#define IO_FILE_STREAM_CHUNK (1024*1024)
+#endif
+
+
+struct io_file_stream {
+	int file_fd;		///< the file being sent.  The stream doesn't close it.
+	off_t offset;		///< the next byte of the file to send.
+	off_t end;			///< one past the last byte to send.
+	int *flags;			///< the socket atom's current flags.  We manage IO_WRITE.
+};
+typedef struct io_file_stream io_file_stream;
+
+
+/** Nonzero once the whole region has been sent. */
+#define io_file_stream_done(fs) ((fs)->offset >= (fs)->end)
+
+/** The number of bytes still to be sent. */
+#define io_file_stream_remaining(fs) ((fs)->end - (fs)->offset)
+
+
+/** Prepares to send len bytes of file_fd starting at offset.
+ *
+ * @param flags points to the flags the socket atom currently has.
+ *   The stream turns IO_WRITE on and off as needed and leaves the
+ *   other flags alone.
+ */
+
+void io_file_stream_init(io_file_stream *fs, int file_fd, off_t offset, off_t len, int *flags);
+
+
+/** Sends as much of the file as the socket will take.
+ *
+ * Call this once to start the transfer, then from the atom's write
+ * proc until io_file_stream_done.
+ *
+ * @returns 0 (check io_file_stream_done to see if you're finished),
+ * EIO if the file turned out to be shorter than the region, or an
+ * error from sendfile (EPIPE or ECONNRESET if the remote went away).
+ * EAGAIN is never returned.
+ */
+
+int io_file_stream_send(struct io_poller *poller, io_atom *io, io_file_stream *fs);
+
+#endif
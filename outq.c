@@ -0,0 +1,257 @@
+/** @file outq.c
+ *
+ * Queues output for an atom and writes it with writev as the atom
+ * becomes writable.  See outq.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/uio.h>
+
+#include "poller.h"
+#include "outq.h"
+
+
+// Sets the atom's flags to match what the queue needs.
+
+static int update_flags(io_poller *poller, io_outq *q)
+{
+	int flags = 0;
+	int err;
+
+	if(q->reading && !q->paused) {
+		flags |= IO_READ;
+	}
+	if(q->head) {
+		flags |= IO_WRITE;
+	}
+
+	if(flags == q->flags) {
+		return 0;
+	}
+
+	err = io_set(poller, q->atom, flags);
+	if(!err) {
+		q->flags = flags;
+	}
+	return err;
+}
+
+
+// Stops or restarts reading from the peer depending on how much
+// data is queued.
+
+static void check_watermarks(io_poller *poller, io_outq *q)
+{
+	io_outq *peer = q->peer;
+
+	if(!peer || !q->high) {
+		return;
+	}
+
+	if(!peer->paused && q->queued > q->high) {
+		peer->paused = 1;
+		update_flags(poller, peer);
+	} else if(peer->paused && q->queued <= q->low) {
+		peer->paused = 0;
+		update_flags(poller, peer);
+	}
+}
+
+
+static void release_chunk(io_outq_chunk *chunk)
+{
+	if(chunk->release) {
+		(*chunk->release)(chunk);
+	}
+}
+
+
+static void free_chunk(io_outq_chunk *chunk)
+{
+	free(chunk);
+}
+
+
+void io_outq_init(io_outq *q, io_atom *atom, int flags)
+{
+	q->atom = atom;
+	q->flags = flags;
+	q->reading = (flags & IO_READ) ? 1 : 0;
+	q->paused = 0;
+	q->head = NULL;
+	q->tail = &q->head;
+	q->queued = 0;
+	q->peer = NULL;
+	q->high = 0;
+	q->low = 0;
+}
+
+
+void io_outq_dispose(io_poller *poller, io_outq *q)
+{
+	io_outq_chunk *chunk;
+
+	while((chunk = q->head)) {
+		q->head = chunk->next;
+		release_chunk(chunk);
+	}
+	q->tail = &q->head;
+	q->queued = 0;
+
+	// don't leave the peer stuck.  It might be us, which is harmless.
+	if(q->peer && q->peer != q && q->peer->paused) {
+		q->peer->paused = 0;
+		update_flags(poller, q->peer);
+	}
+	// and don't let it pause or resume us once we're gone.
+	if(q->peer && q->peer->peer == q) {
+		q->peer->peer = NULL;
+	}
+	q->peer = NULL;
+}
+
+
+void io_outq_set_watermarks(io_outq *q, io_outq *peer, size_t high, size_t low)
+{
+	q->peer = peer;
+	q->high = high;
+	q->low = low < high ? low : high;
+}
+
+
+int io_outq_set_read(io_poller *poller, io_outq *q, int on)
+{
+	q->reading = on ? 1 : 0;
+	return update_flags(poller, q);
+}
+
+
+static void link_chunk(io_poller *poller, io_outq *q, io_outq_chunk *chunk)
+{
+	chunk->next = NULL;
+	*q->tail = chunk;
+	q->tail = &chunk->next;
+	q->queued += chunk->len;
+	check_watermarks(poller, q);
+}
+
+
+int io_outq_write(io_poller *poller, io_outq *q, const char *buf, size_t len)
+{
+	io_outq_chunk *chunk;
+	size_t wlen;
+	int err;
+
+	if(!q->head) {
+		// nothing is queued so try to write it straight out.
+		err = io_write(poller, q->atom, buf, len, &wlen);
+		if(err && err != EAGAIN) {
+			return err;
+		}
+		buf += wlen;
+		len -= wlen;
+		if(!len) {
+			return 0;
+		}
+	}
+
+	chunk = malloc(sizeof(io_outq_chunk) + len);
+	if(!chunk) {
+		return ENOMEM;
+	}
+	memcpy(chunk + 1, buf, len);
+	io_outq_init_chunk(chunk, (const char*)(chunk + 1), len, free_chunk);
+
+	link_chunk(poller, q, chunk);
+	return update_flags(poller, q);
+}
+
+
+int io_outq_append(io_poller *poller, io_outq *q, io_outq_chunk *chunk)
+{
+	int was_empty = !q->head;
+
+	link_chunk(poller, q, chunk);
+	if(was_empty) {
+		return io_outq_flush(poller, q);
+	}
+	return 0;
+}
+
+
+int io_outq_extend(io_poller *poller, io_outq *q, size_t len)
+{
+	io_outq_chunk *last = io_outq_last(q);
+
+	if(!last) {
+		return EINVAL;
+	}
+
+	// the queue isn't empty so IO_WRITE is already on.
+	last->len += len;
+	q->queued += len;
+	check_watermarks(poller, q);
+	return 0;
+}
+
+
+// Drops len bytes from the front of the queue.
+
+static void consume(io_outq *q, size_t len)
+{
+	io_outq_chunk *chunk;
+
+	q->queued -= len;
+	while((chunk = q->head) && len >= chunk->len) {
+		len -= chunk->len;
+		q->head = chunk->next;
+		if(!q->head) {
+			q->tail = &q->head;
+		}
+		release_chunk(chunk);
+	}
+
+	if(chunk) {
+		chunk->data += len;
+		chunk->len -= len;
+	}
+}
+
+
+int io_outq_flush(io_poller *poller, io_outq *q)
+{
+	struct iovec iov[IO_OUTQ_IOVECS];
+	io_outq_chunk *chunk;
+	size_t total, wlen;
+	int n, err = 0;
+
+	while(q->head) {
+		total = 0;
+		for(n=0, chunk=q->head; n<IO_OUTQ_IOVECS && chunk; n++, chunk=chunk->next) {
+			iov[n].iov_base = (void*)chunk->data;
+			iov[n].iov_len = chunk->len;
+			total += chunk->len;
+		}
+
+		err = io_writev(poller, q->atom, iov, n, &wlen);
+		if(err) {
+			if(err == EAGAIN) {
+				err = 0;
+			}
+			break;
+		}
+
+		consume(q, wlen);
+		if(wlen < total) {
+			break;	// the kernel's buffer is full
+		}
+	}
+
+	check_watermarks(poller, q);
+	if(err) {
+		return err;
+	}
+	return update_flags(poller, q);
+}
@@ -0,0 +1,154 @@
+/** @file outq.h
+ *
+ * An output queue for an io_atom.
+ *
+ * io_write may only write part of your data.  Rather than dropping the
+ * rest, write through an io_outq: whatever the kernel won't take right
+ * now is queued and written with a single io_writev the next time the
+ * atom is writable.  The queue turns IO_WRITE on while it holds data
+ * and off again once it's empty, so it owns the atom's flags.  Use
+ * io_outq_set_read rather than calling io_set yourself.
+ *
+ * Give the queue a peer (the atom whose reads fill it) and watermarks
+ * and it will stop reading from the peer once more than high bytes are
+ * queued, resuming when the queue drains below low.  A slow client
+ * can't make us buffer without limit.  In an echo server the peer is
+ * the queue itself; in a proxy it's the queue on the other connection.
+ *
+ * Call io_outq_flush from the atom's write_proc.
+ */
+
+#ifndef IO_OUTQ_H
+#define IO_OUTQ_H
+
+#include <stddef.h>
+#include "atom.h"
+
+
+/// The most iovecs handed to a single io_writev.
+#ifndef IO_OUTQ_IOVECS
+#define IO_OUTQ_IOVECS 64
+#endif
+
+
+struct io_outq_chunk;
+
+/** Called once a chunk has been completely written or the queue
+ *  has been disposed.  After this the queue no longer touches it.
+ */
+
+typedef void (*io_outq_release_proc)(struct io_outq_chunk *chunk);
+
+
+/** A piece of data waiting to be written.
+ *
+ * io_outq_write copies your data into chunks that it allocates.  To
+ * queue data without copying it, supply your own chunk to
+ * io_outq_append along with a release proc to get it back.
+ */
+
+struct io_outq_chunk {
+	struct io_outq_chunk *next;
+	const char *data;				///< the data that hasn't been written yet.
+	size_t len;						///< the number of bytes at data.
+	io_outq_release_proc release;	///< may be NULL.
+};
+typedef struct io_outq_chunk io_outq_chunk;
+
+
+struct io_outq {
+	io_atom *atom;
+	int flags;				///< the flags currently set on atom.
+	int reading;			///< set if you want IO_READ (see io_outq_set_read).
+	int paused;				///< set while a queue has stopped reading from this one's atom.
+
+	io_outq_chunk *head;	///< the oldest chunk, the next to be written.
+	io_outq_chunk **tail;	///< where to link the next chunk.
+	size_t queued;			///< the number of bytes waiting to be written.
+
+	struct io_outq *peer;	///< the queue whose atom's reads fill this one, or NULL.
+	size_t high;			///< stop reading from the peer when queued goes above this.
+	size_t low;				///< start reading again when queued falls to this.
+};
+typedef struct io_outq io_outq;
+
+
+#define io_outq_init_chunk(c,d,l,r) ((c)->next=NULL,(c)->data=(d),(c)->len=(l),(c)->release=(r))
+
+/** Nonzero if the queue has data waiting to be written. */
+#define io_outq_pending(q) ((q)->head != NULL)
+
+/** The newest chunk on the queue, or NULL if it's empty.  (tail points
+ *  at its next field, which is the first field in the chunk.)
+ */
+#define io_outq_last(q) ((q)->head ? (io_outq_chunk*)(q)->tail : NULL)
+
+
+/** Attaches a queue to an atom that has already been added to the
+ *  poller with the given flags.
+ */
+
+void io_outq_init(io_outq *q, io_atom *atom, int flags);
+
+
+/** Releases all queued chunks.  If this queue paused its peer,
+ *  the peer is resumed, and if the peer's peer is this queue, it's
+ *  cleared.  Call this before closing the atom.
+ */
+
+void io_outq_dispose(struct io_poller *poller, io_outq *q);
+
+
+/** Stops reading from peer while more than high bytes are queued.
+ *
+ * Reading resumes once the queue drains to low bytes.  peer may be
+ * this queue (an echo server) or another one (a proxy).  A high of 0
+ * turns off flow control.
+ */
+
+void io_outq_set_watermarks(io_outq *q, io_outq *peer, size_t high, size_t low);
+
+
+/** Writes as much of buf as possible now and queues the rest.
+ *
+ * The data is copied so buf can be reused as soon as this returns.
+ * @returns 0, ENOMEM, or the error from io_write (EPIPE if the remote
+ * has gone away).  EAGAIN is never returned.
+ */
+
+int io_outq_write(struct io_poller *poller, io_outq *q, const char *buf, size_t len);
+
+
+/** Queues a chunk without copying its data.
+ *
+ * The chunk and its data must remain valid until its release proc is
+ * called.  Returns the same errors as io_outq_write.
+ */
+
+int io_outq_append(struct io_poller *poller, io_outq *q, io_outq_chunk *chunk);
+
+
+/** Adds len bytes to the end of the newest chunk.
+ *
+ * Write the data just past the chunk's end first.  The chunk must
+ * still belong to you (it's not shared with anything else that might
+ * write there).  Returns EINVAL if the queue is empty.
+ */
+
+int io_outq_extend(struct io_poller *poller, io_outq *q, size_t len);
+
+
+/** Writes as much of the queue as the kernel will take.  Call this
+ *  from the atom's write proc.  Returns 0 or an error from io_writev.
+ */
+
+int io_outq_flush(struct io_poller *poller, io_outq *q);
+
+
+/** Turns IO_READ on or off for the queue's atom without disturbing
+ *  the IO_WRITE flag that the queue manages.
+ */
+
+int io_outq_set_read(struct io_poller *poller, io_outq *q, int on);
+
+#endif
@@ -3,109 +3,543 @@
 // 8 Mar 2007
 
 // Allows you to select what poller you'd like to use at runtime.
+// Also holds the routines that are common to all pollers: the
+// cross-thread post queue lives here.
 
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/eventfd.h>
 #include "poller.h"
 
 
+// These are handled by identical routines in all pollers
+// except for the mock poller.
+#define ATOM_FUNCS \
+	.read = io_atom_read, \
+	.readv = io_atom_readv, \
+	.write = io_atom_write, \
+	.writev = io_atom_writev, \
+	.connect = io_socket_connect, \
+	.accept = io_socket_accept, \
+	.listen = io_socket_listen, \
+	.close = io_atom_close
+
+
+#ifdef USE_URING
+static const struct io_poller_funcs uring_funcs = {
+	.name = "io_uring",
+	.type = IO_POLLER_URING,
+	.caps = IO_CAP_COMPLETION | IO_CAP_ERROR_PROC,
+	.size = sizeof(io_uring_poller),
+	.init = (void*)io_uring_init,
+	.dispose = (void*)io_uring_poller_dispose,
+	.fd_check = (void*)io_uring_fd_check,
+	.add = (void*)io_uring_add,
+	.remove = (void*)io_uring_remove,
+	.set = (void*)io_uring_set,
+	.wait = (void*)io_uring_wait,
+	.dispatch = io_uring_dispatch,
+	.submit = io_uring_submit_request,
+	.cancel = io_uring_cancel_request,
+	ATOM_FUNCS
+};
+#endif
+
+
+#ifdef USE_EPOLL
+static const struct io_poller_funcs epoll_funcs = {
+	.name = "epoll",
+	.type = IO_POLLER_EPOLL,
+	.caps = IO_CAP_ERROR_PROC,
+	.size = sizeof(io_epoll_poller),
+	.init = (void*)io_epoll_init,
+	.dispose = (void*)io_epoll_poller_dispose,
+	.fd_check = (void*)io_epoll_fd_check,
+	.add = (void*)io_epoll_add,
+	.remove = (void*)io_epoll_remove,
+	.set = (void*)io_epoll_set,
+	.wait = (void*)io_epoll_wait,
+	.dispatch = io_epoll_dispatch,
+	.submit = io_stream_emulate_submit,
+	.cancel = io_stream_emulate_cancel,
+	ATOM_FUNCS
+};
+#endif
+
+
+#ifdef USE_POLL
+static const struct io_poller_funcs poll_funcs = {
+	.name = "poll",
+	.type = IO_POLLER_POLL,
+	.caps = IO_CAP_ERROR_PROC,
+	.size = sizeof(io_poll_poller),
+	.init = (void*)io_poll_init,
+	.dispose = (void*)io_poll_poller_dispose,
+	.fd_check = (void*)io_poll_fd_check,
+	.add = (void*)io_poll_add,
+	.remove = (void*)io_poll_remove,
+	.set = (void*)io_poll_set,
+	.wait = (void*)io_poll_wait,
+	.dispatch = io_poll_dispatch,
+	.submit = io_stream_emulate_submit,
+	.cancel = io_stream_emulate_cancel,
+	ATOM_FUNCS
+};
+#endif
+
+
+#ifdef USE_SELECT
+static const struct io_poller_funcs select_funcs = {
+	.name = "select",
+	.type = IO_POLLER_SELECT,
+	.size = sizeof(io_select_poller),
+	.init = (void*)io_select_init,
+	.dispose = (void*)io_select_poller_dispose,
+	.fd_check = (void*)io_select_fd_check,
+	.add = (void*)io_select_add,
+	.remove = (void*)io_select_remove,
+	.set = (void*)io_select_set,
+	.wait = (void*)io_select_wait,
+	.dispatch = io_select_dispatch,
+	.submit = io_stream_emulate_submit,
+	.cancel = io_stream_emulate_cancel,
+	ATOM_FUNCS
+};
+#endif
+
+
+#ifdef USE_MOCK
+static const struct io_poller_funcs mock_funcs = {
+	.name = "mock",
+	.type = IO_POLLER_MOCK,
+	.size = sizeof(io_mock_poller),
+	.init = (void*)io_mock_init,
+	.dispose = (void*)io_mock_poller_dispose,
+	.fd_check = (void*)io_mock_fd_check,
+	.add = (void*)io_mock_add,
+	.remove = (void*)io_mock_remove,
+	.set = (void*)io_mock_set,
+	.wait = (void*)io_mock_wait,
+	.dispatch = io_mock_dispatch,
+	.submit = io_stream_emulate_submit,
+	.cancel = io_stream_emulate_cancel,
+	.read = io_mock_read,
+	.readv = io_mock_readv,
+	.write = io_mock_write,
+	.writev = io_mock_writev,
+	.connect = io_mock_connect,
+	.accept = io_mock_accept,
+	.listen = io_mock_listen,
+	.close = io_mock_close
+};
+#endif
+
+
+// The backends in the order that io_poller_init tries them: fastest first.
+
+static const struct io_poller_funcs *backends[] = {
+#ifdef IO_STATIC_BACKEND
+	// the macros call this backend directly so it's the only one we can use.
+	&IO_CAT(IO_STATIC_BACKEND,_funcs),
+#else
+#ifdef USE_URING
+	&uring_funcs,
+#endif
+#ifdef USE_EPOLL
+	&epoll_funcs,
+#endif
+#ifdef USE_POLL
+	&poll_funcs,
+#endif
+#ifdef USE_SELECT
+	&select_funcs,
+#endif
+#ifdef USE_MOCK
+	&mock_funcs,
+#endif
+#endif
+	NULL
+};
+
+
+// Returns the index into poller->rejected for the given backend.
+
+static int rejected_index(io_poller_type type)
+{
+	return __builtin_ctz(type);
+}
+
+
+static int init_backend(io_poller *poller, const struct io_poller_funcs *funcs)
+{
+	int err;
+
+	poller->poller_data.any = calloc(1, funcs->size);
+	if(!poller->poller_data.any) {
+		return ENOMEM;
+	}
+
+	err = (*funcs->init)(poller->poller_data.any);
+	if(err) {
+		free(poller->poller_data.any);
+		poller->poller_data.any = NULL;
+		return err;
+	}
+
+	poller->funcs = funcs;
+	poller->poller_name = funcs->name;
+	poller->poller_type = funcs->type;
+	return 0;
+}
+
+
+// Tries each backend allowed by type, fastest first.  A backend whose
+// syscalls aren't available (ENOSYS: old kernel, EPERM: seccomp or
+// sysctl) is skipped and the reason is remembered.  Any other error
+// is returned immediately.
+
+static int probe_backends(io_poller *poller, io_poller_type type)
+{
+	const struct io_poller_funcs **funcs;
+	int err = -1;
+
+	for(funcs=backends; *funcs; funcs++) {
+		if(!(type & (*funcs)->type)) {
+			continue;
+		}
+
+		err = init_backend(poller, *funcs);
+		if(err != ENOSYS && err != EPERM) {
+			return err;
+		}
+
+		if((*funcs)->type != IO_POLLER_MOCK) {
+			poller->rejected[rejected_index((*funcs)->type)] = err;
+		}
+	}
+
+	return err;
+}
+
+
+/** Returns the error that made io_poller_init pass over the given
+ *  backend (ENOSYS or EPERM), or 0 if it wasn't rejected.
+ */
+
+int io_poller_rejected(io_poller *poller, io_poller_type backend)
+{
+	if(!backend || backend >= IO_POLLER_MOCK || (backend & (backend-1))) {
+		return 0;
+	}
+	return poller->rejected[rejected_index(backend)];
+}
+
+
+/** Walks the backends that io_poller_init passed over, fastest first.
+ *
+ *  Set *pos to 0 before the first call.  Returns the next rejected
+ *  backend's name and puts the reason in *err, or NULL when there are
+ *  no more.
+ */
+
+const char* io_poller_next_rejected(io_poller *poller, int *pos, int *err)
+{
+	const struct io_poller_funcs *funcs;
+
+	while((funcs = backends[*pos])) {
+		*pos += 1;
+		*err = io_poller_rejected(poller, funcs->type);
+		if(*err) {
+			return funcs->name;
+		}
+	}
+
+	return NULL;
+}
+
+
+static void dispose_backend(io_poller *poller)
+{
+	(*poller->funcs->dispose)(poller->poller_data.any);
+	free(poller->poller_data.any);
+	poller->poller_data.any = NULL;
+}
+
+
+// The post queue is Dmitry Vyukov's intrusive MPSC queue.  Producers
+// only ever swap post_tail so posting is lock-free from any thread.
+// Only the poller's own thread pops from post_head.
+
+static void post_push(io_poller *poller, io_post *post)
+{
+	io_post *prev;
+
+	__atomic_store_n(&post->next, NULL, __ATOMIC_RELAXED);
+	prev = __atomic_exchange_n(&poller->post_tail, post, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&prev->next, post, __ATOMIC_RELEASE);
+}
+
+
+// Returns the oldest post, or NULL if there are none.  Sets *busy if
+// a producer is halfway through pushing (there are more posts, we
+// just can't get at them yet).
+
+static io_post* post_pop(io_poller *poller, int *busy)
+{
+	io_post *head = poller->post_head;
+	io_post *next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+
+	if(head == &poller->post_stub) {
+		if(!next) {
+			return NULL;
+		}
+		poller->post_head = next;
+		head = next;
+		next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+	}
+
+	if(next) {
+		poller->post_head = next;
+		return head;
+	}
+
+	if(head != __atomic_load_n(&poller->post_tail, __ATOMIC_ACQUIRE)) {
+		*busy = 1;
+		return NULL;
+	}
+
+	post_push(poller, &poller->post_stub);
+	next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+	if(next) {
+		poller->post_head = next;
+		return head;
+	}
+
+	*busy = 1;
+	return NULL;
+}
+
+
+static void wake(io_poller *poller)
+{
+	uint64_t one = 1;
+	ssize_t len;
+
+	if(poller->post_atom.fd < 0) {
+		return;		// the mock poller never blocks.
+	}
+
+	do {
+		len = write(poller->post_atom.fd, &one, sizeof(one));
+	} while(len < 0 && errno == EINTR);
+}
+
+
+static void post_read_proc(io_poller *poller, io_atom *ioa)
+{
+	uint64_t cnt;
+	ssize_t len;
+
+	// Just reset the eventfd.  The queue is drained at the end of
+	// io_dispatch, after all the fd events have been handled.
+	do {
+		len = read(ioa->fd, &cnt, sizeof(cnt));
+	} while(len < 0 && errno == EINTR);
+}
+
+
+static void drain_posts(io_poller *poller)
+{
+	io_post *post, *last;
+	io_post_proc proc;
+	void *arg;
+	int busy = 0;
+	int done;
+
+	if(poller->post_head == &poller->post_stub &&
+		!__atomic_load_n(&poller->post_stub.next, __ATOMIC_ACQUIRE)) {
+		return;		// nothing has been posted
+	}
+
+	// Any post that arrives after this point will wake us again.
+	__atomic_store_n(&poller->post_signalled, 0, __ATOMIC_SEQ_CST);
+
+	// Only run what was posted before we started so a proc that
+	// posts to its own poller can't keep us here forever.  If the tail
+	// is the stub, the posts before it are the batch and we stop when
+	// we reach it.
+	last = __atomic_load_n(&poller->post_tail, __ATOMIC_ACQUIRE);
+
+	while(!(last == &poller->post_stub && poller->post_head == last) &&
+			(post = post_pop(poller, &busy))) {
+		done = (post == last);
+		proc = post->proc;
+		arg = post->arg;
+		if(post->allocated) {
+			free(post);
+		}
+		(*proc)(poller, arg);
+		if(done) {
+			break;
+		}
+	}
+
+	if(busy) {
+		// a producer was interrupted mid-push.  It may have already seen
+		// post_signalled set so make sure we come back for its post.
+		__atomic_store_n(&poller->post_signalled, 1, __ATOMIC_SEQ_CST);
+		wake(poller);
+	}
+}
+
+
 /**
  * @param type: specifies what types of poller you want to
  * create.  For instance, POLLER_SELECT|POLLER_EPOLL, or
- * POLLER_LINUX.
+ * POLLER_LINUX.  The fastest one that works on this system is used;
+ * see io_poller_rejected to find out why faster ones didn't.
  */
 
-
 int io_poller_init(io_poller *poller, io_poller_type type)
 {
-	// TODO: make this routine select a proper poller at runtime.
-	// TODO: this routine should probably also take an argument
-	//		to allow the caller to select the poller to use.
+	int fd, err;
 
 	memset(poller, 0, sizeof(io_poller));
-	
-	// These are handled by identical routines in all pollers
-	// except for the mock poller.
-	poller->funcs.read = io_atom_read;
-	poller->funcs.readv = io_atom_readv;
-	poller->funcs.write = io_atom_write;
-	poller->funcs.writev = io_atom_writev;
-	poller->funcs.connect = io_socket_connect;
-	poller->funcs.accept = io_socket_accept;
-	poller->funcs.listen = io_socket_listen;
-	poller->funcs.close = io_atom_close;
 
-#ifdef USE_EPOLL
-	if(type & IO_POLLER_EPOLL) {
-		poller->poller_name = "epoll";
-		poller->poller_type = IO_POLLER_EPOLL;
-		poller->funcs.dispose = (void*)io_epoll_poller_dispose;
-		poller->funcs.fd_check = (void*)io_epoll_fd_check;
-		poller->funcs.add = (void*)io_epoll_add;
-		poller->funcs.remove = (void*)io_epoll_remove;
-		poller->funcs.set = (void*)io_epoll_set;
-		poller->funcs.wait = (void*)io_epoll_wait;
-		poller->funcs.dispatch = (void*)io_epoll_dispatch;
-		return io_epoll_init(&poller->poller_data.epoll);
+	err = probe_backends(poller, type);
+	if(err) {
+		return err;
 	}
-#endif
 
-	
-#ifdef USE_POLL
-	if(type & IO_POLLER_POLL) {
-		poller->poller_name = "poll";
-		poller->poller_type = IO_POLLER_POLL;
-		poller->funcs.dispose = (void*)io_poll_poller_dispose;
-		poller->funcs.fd_check = (void*)io_poll_fd_check;
-		poller->funcs.add = (void*)io_poll_add;
-		poller->funcs.remove = (void*)io_poll_remove;
-		poller->funcs.set = (void*)io_poll_set;
-		poller->funcs.wait = (void*)io_poll_wait;
-		poller->funcs.dispatch = (void*)io_poll_dispatch;
-		return io_poll_init(&poller->poller_data.poll);
+	poller->post_head = &poller->post_stub;
+	poller->post_tail = &poller->post_stub;
+	io_atom_init(&poller->post_atom, -1, post_read_proc, NULL);
+
+	if(io_is_mock(poller)) {
+		return 0;
 	}
-#endif
 
-	
-#ifdef USE_SELECT
-	if(type & IO_POLLER_SELECT) {
-		poller->poller_name = "select";
-		poller->poller_type = IO_POLLER_SELECT;
-		poller->funcs.dispose = (void*)io_select_poller_dispose;
-		poller->funcs.fd_check = (void*)io_select_fd_check;
-		poller->funcs.add = (void*)io_select_add;
-		poller->funcs.remove = (void*)io_select_remove;
-		poller->funcs.set = (void*)io_select_set;
-		poller->funcs.wait = (void*)io_select_wait;
-		poller->funcs.dispatch = (void*)io_select_dispatch;
-		return io_select_init(&poller->poller_data.select);
+	fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(fd < 0) {
+		err = errno ? errno : -1;
+		dispose_backend(poller);
+		return err;
 	}
-#endif
-	
-	
-#ifdef USE_MOCK
-	if(type & IO_POLLER_MOCK) {
-		poller->poller_name = "mock";
-		poller->poller_type = IO_POLLER_MOCK;
-		poller->funcs.dispose = (void*)io_mock_poller_dispose;
-		poller->funcs.fd_check = (void*)io_mock_fd_check;
-		poller->funcs.add = (void*)io_mock_add;
-		poller->funcs.remove = (void*)io_mock_remove;
-		poller->funcs.set = (void*)io_mock_set;
-		poller->funcs.wait = (void*)io_mock_wait;
-		poller->funcs.dispatch = (void*)io_mock_dispatch;
-		
-		poller->funcs.read = io_mock_read;
-		poller->funcs.readv = io_mock_readv;
-		poller->funcs.write = io_mock_write;
-		poller->funcs.writev = io_mock_writev;
-		poller->funcs.connect = io_mock_connect;
-		poller->funcs.accept = io_mock_accept;
-		poller->funcs.listen = io_mock_listen;
-		poller->funcs.close = io_mock_close;
-		return io_mock_init(&poller->poller_data.mock);
+
+	poller->post_atom.fd = fd;
+	err = io_add(poller, &poller->post_atom, IO_READ);
+	if(err) {
+		close(fd);
+		dispose_backend(poller);
+		return err;
+	}
+
+	return 0;
+}
+
+
+int io_poller_dispose(io_poller *poller)
+{
+	io_post *post;
+	int busy = 0;
+
+	// posts that never ran are simply dropped.
+	while((post = post_pop(poller, &busy))) {
+		if(post->allocated) {
+			free(post);
+		}
+	}
+
+	if(poller->post_atom.fd >= 0) {
+		io_remove(poller, &poller->post_atom);
+		close(poller->post_atom.fd);
+		poller->post_atom.fd = -1;
+	}
+
+	free(poller->timers);
+	poller->timers = NULL;
+
+	dispose_backend(poller);
+	return 0;
+}
+
+
+/** Waits for events, but never past the next pending timer. */
+
+int io_poller_wait(io_poller *poller, unsigned int timeout)
+{
+	if(poller->timers) {
+		timeout = io_timer_wheel_timeout(poller->timers, timeout);
 	}
+#ifdef IO_STATIC_BACKEND
+	return IO_STATIC_FN(wait)(IO_STATIC_DATA(poller), timeout);
+#else
+	return (*poller->funcs->wait)(poller->poller_data.any, timeout);
+#endif
+}
+
+
+int io_poller_dispatch(io_poller *poller)
+{
+	int err;
+
+#ifdef IO_STATIC_BACKEND
+	err = IO_STATIC_FN(dispatch)(poller);
+#else
+	err = (*poller->funcs->dispatch)(poller);
 #endif
-	
+	drain_posts(poller);
+	if(poller->timers) {
+		io_timer_wheel_run(poller, poller->timers);
+	}
+
+	return err;
+}
+
+
+static void post(io_poller *poller, io_post *node, io_post_proc proc, void *arg, int allocated)
+{
+	node->proc = proc;
+	node->arg = arg;
+	node->allocated = allocated;
+	post_push(poller, node);
+
+	// A burst of posts only needs to wake the poller once.
+	if(!__atomic_exchange_n(&poller->post_signalled, 1, __ATOMIC_SEQ_CST)) {
+		wake(poller);
+	}
+}
+
+
+/** Queues proc to be called on the poller's thread.
+ *
+ * This is the only routine that may be called on a poller from a
+ * thread other than the one that is running it.  The node is supplied
+ * by the caller so this never allocates.  It must remain valid until
+ * proc has been called.
+ */
+
+int io_poller_post_node(io_poller *poller, io_post *node, io_post_proc proc, void *arg)
+{
+	post(poller, node, proc, arg, 0);
+	return 0;
+}
+
+
+/** Like io_poller_post_node but allocates the node for you.
+ */
+
+int io_poller_post(io_poller *poller, io_post_proc proc, void *arg)
+{
+	io_post *node;
+
+	node = malloc(sizeof(io_post));
+	if(!node) {
+		return ENOMEM;
+	}
 
-	return -1;
+	post(poller, node, proc, arg, 1);
+	return 0;
 }
@@ -6,29 +6,54 @@
 // (it allows you to use different polling methods in different
 // threads but I don't see much point to that.)
 
-// TODO: should get rid of these include and just make io_poller's
-// poller_data opaque!  That would also fix the huge disparity between
-// epoll/kqueue's tiny poller_data, and poll/select's huge poller_data.
-// Each poller would just get a few void*s or something, and would have
-// malloc its own data.
-
-// TODO: should use a single, static function table for each poller.
-// The poller data structure should be a pointer to the static table
-// of functions and a void* or int.  (true?  isn't this method faster,
-// especially on multiprocessor systems that have to synch cache lines?)
-
-// TODO: try to use preprocessor to decide what pollers are even compilable.
-
-
 #include "atom.h"
 #include "socket.h"
+#include "stream.h"
+#include "timer.h"
 
 #ifndef POLLER_H
 #define POLLER_H
 
-#if !(defined(USE_SELECT) || defined(USE_POLL) || defined(USE_EPOLL))
-// lowest common denominator, available on all platforms
+#define IO_CAT_(a,b) a##b
+#define IO_CAT(a,b) IO_CAT_(a,b)
+
+// Compile with -DIO_STATIC_BACKEND=epoll (or select, poll, uring) to
+// call that backend's routines directly instead of through the
+// function table.  With -flto they can then be inlined into your
+// procs.  Only that backend can be used, and it's compiled in for you.
+#ifdef IO_STATIC_BACKEND
+#define IO_STATIC_ID_select 1
+#define IO_STATIC_ID_poll 2
+#define IO_STATIC_ID_epoll 3
+#define IO_STATIC_ID_uring 4
+#define IO_STATIC_ID IO_CAT(IO_STATIC_ID_,IO_STATIC_BACKEND)
+#if IO_STATIC_ID == IO_STATIC_ID_select
 #define USE_SELECT
+#elif IO_STATIC_ID == IO_STATIC_ID_poll
+#define USE_POLL
+#elif IO_STATIC_ID == IO_STATIC_ID_epoll
+#define USE_EPOLL
+#elif IO_STATIC_ID == IO_STATIC_ID_uring
+#define USE_URING
+#else
+#error "IO_STATIC_BACKEND must be select, poll, epoll or uring"
+#endif
+#endif
+
+#if !(defined(USE_SELECT) || defined(USE_POLL) || defined(USE_EPOLL) || defined(USE_URING))
+// No poller was asked for so compile in everything the platform has.
+// io_poller_init picks the fastest one that works at runtime.
+// select is the lowest common denominator, available on all platforms.
+#define USE_SELECT
+#define USE_POLL
+#ifdef __linux__
+#define USE_EPOLL
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define USE_URING
+#endif
+#endif
+#endif
 #endif
 
 #ifdef USE_SELECT
@@ -43,6 +68,10 @@
 #include "pollers/epoll.h"
 #endif
 
+#ifdef USE_URING
+#include "pollers/uring.h"
+#endif
+
 #ifdef USE_MOCK
 #include "pollers/mock.h"
 #endif
@@ -58,23 +87,40 @@ typedef enum {
 	IO_POLLER_POLL = 0x02,
 	IO_POLLER_EPOLL = 0x04,
 	IO_POLLER_KQUEUE = 0x08,
+	IO_POLLER_URING = 0x10,
 	IO_POLLER_MOCK = 0x80,
 
-	IO_POLLER_ANY = 0xFF,		///< chooses the fastest poller for the platform
-	IO_POLLER_LINUX = IO_POLLER_SELECT | IO_POLLER_POLL | IO_POLLER_EPOLL,
+	IO_POLLER_ANY = 0x7F,		///< chooses the fastest poller that works (never mock)
+	IO_POLLER_LINUX = IO_POLLER_SELECT | IO_POLLER_POLL | IO_POLLER_EPOLL | IO_POLLER_URING,
 	IO_POLLER_BSD = IO_POLLER_SELECT | IO_POLLER_POLL | IO_POLLER_KQUEUE
 } io_poller_type;
 
 
+/// Capability: the poller performs io_submit_read/io_submit_write natively
+/// rather than emulating them with readiness events.
+#define IO_CAP_COMPLETION 0x01
+/// Capability: the poller calls an atom's error_proc when its fd reports an error.
+#define IO_CAP_ERROR_PROC 0x02
+
+
 // Believe you me, this table is *almost* enough to drive me to port this to C++.
 // (biggest problem with doing that is having to babysit C++'s memory management)
+//
+// Each backend has a single static, read-only table that's shared by
+// all of its pollers.  The backend routines are passed the backend's
+// state (poller_data), everything else is passed the io_poller.
 struct io_poller_funcs {
-	int (*dispose)(struct io_poller *poller);
-	int (*fd_check)(struct io_poller *poller);
-	int (*add)(struct io_poller *poller, io_atom *atom, int flags);
-	int (*remove)(struct io_poller *poller, io_atom *atom);	
-	int (*set)(struct io_poller *poller, io_atom *atom, int flags);
-	int (*wait)(struct io_poller *poller, unsigned int timeout);
+	const char *name;
+	io_poller_type type;
+	int caps;		///< the IO_CAP_* flags this poller supports.
+	size_t size;	///< the size of the backend's state.
+	int (*init)(void *backend);
+	int (*dispose)(void *backend);
+	int (*fd_check)(void *backend);
+	int (*add)(void *backend, io_atom *atom, int flags);
+	int (*remove)(void *backend, io_atom *atom);	
+	int (*set)(void *backend, io_atom *atom, int flags);
+	int (*wait)(void *backend, unsigned int timeout);
 	int (*dispatch)(struct io_poller *poller);
 	int (*read)(struct io_poller *poller, struct io_atom *io, char *buf, size_t cnt, size_t *readlen);
 	int (*readv)(struct io_poller *poller, struct io_atom *io, const struct iovec *vec, int cnt, size_t *readlen);
@@ -82,58 +128,130 @@ struct io_poller_funcs {
 	int (*writev)(struct io_poller *poller, struct io_atom *io, const struct iovec *vec, int cnt, size_t *wrlen);
 	int (*connect)(struct io_poller *poller, io_atom *io, io_proc read_proc, io_proc write_proc, socket_addr remote, int flags);
 	int (*accept)(struct io_poller *poller, io_atom *io, io_proc read_proc, io_proc write_proc, int flags, io_atom *listener, socket_addr *remote);
-	int (*listen)(struct io_poller *poller, io_atom *io, io_proc read_proc, socket_addr local, int reuse_addr);
+	int (*listen)(struct io_poller *poller, io_atom *io, io_proc read_proc, socket_addr local, int flags);
 	int (*close)(struct io_poller *poller, io_atom *io);
+	int (*submit)(struct io_poller *poller, struct io_request *req);
+	int (*cancel)(struct io_poller *poller, struct io_request *req);
+};
+
+
+/** A routine that was posted to run on the poller's thread. */
+typedef void (*io_post_proc)(struct io_poller *poller, void *arg);
+
+/** A node in the poller's post queue.  See io_poller_post_node. */
+struct io_post {
+	struct io_post *next;
+	io_post_proc proc;
+	void *arg;
+	int allocated;		///< set if io_poller_post allocated this node.
 };
+typedef struct io_post io_post;
 
 
+// The poller itself is just a handle: the backend's state is allocated
+// by io_poller_init at whatever size the backend needs, and the timer
+// wheel is only allocated once a timer is added.  The fields touched
+// by every io_* call come first.
 struct io_poller {
-	struct io_poller_funcs funcs;
-	const char *poller_name;
-	io_poller_type poller_type;
+	const struct io_poller_funcs *funcs;
 	union {
-		// TODO: the select struct is WAY bigger than epoll...
-		// Should not put them in a union with each other!
+		void *any;
 
 #ifdef USE_SELECT
-		io_select_poller select;
+		io_select_poller *select;
 #endif
 
 #ifdef USE_POLL
-		io_poll_poller poll;
+		io_poll_poller *poll;
 #endif
 
 #ifdef USE_EPOLL
-		io_epoll_poller epoll;
+		io_epoll_poller *epoll;
+#endif
+
+#ifdef USE_URING
+		io_uring_poller *uring;
 #endif
 		
 #ifdef USE_MOCK
-		io_mock_poller mock;
+		io_mock_poller *mock;
 #endif
 		
 	} poller_data;
+
+	const char *poller_name;
+	io_poller_type poller_type;
+	short rejected[5];		///< why faster backends were passed over, see io_poller_rejected.
+
+	// The post queue.  Posts may come from any thread.
+	int post_signalled;		///< set once the eventfd has been written; cleared by io_dispatch.
+	io_post *post_tail;		///< swapped atomically by posting threads.
+	io_post *post_head;		///< only touched by the poller's thread.
+	io_atom post_atom;		///< an eventfd, written to wake the poller.
+	io_post post_stub;
+
+	io_timer_wheel *timers;	///< the timers that fire from io_dispatch, NULL until one is added.
 };
 typedef struct io_poller io_poller;
 
 
 int io_poller_init(io_poller *poller, io_poller_type type);
-#define io_poller_dispose(a) (*(a)->funcs.dispose)((io_poller*)&(a)->poller_data)
-#define io_fd_check(a)		(*(a)->funcs.fd_check)((io_poller*)&(a)->poller_data)
-#define io_add(a,b,c)		(*(a)->funcs.add)((io_poller*)&(a)->poller_data,b,c)
-#define io_remove(a,b)		(*(a)->funcs.remove)((io_poller*)&(a)->poller_data,b)
-#define io_set(a,b,c)		(*(a)->funcs.set)((io_poller*)&(a)->poller_data,b,c)
-#define io_wait(a,b)		(*(a)->funcs.wait)((io_poller*)&(a)->poller_data,b)
-#define io_dispatch(a)		(*(a)->funcs.dispatch)(a)
-#define io_read(a,io,buf,cnt,rdlen)   (*(a)->funcs.read)(a,io,buf,cnt,rdlen)
-#define io_readv(a,io,vec,rdlen)   (*(a)->funcs.read)(a,io,vec,rdlen)
-#define io_write(a,io,buf,cnt,wrlen)  (*(a)->funcs.write)(a,io,buf,cnt,wrlen)
-#define io_writev(a,io,vec,cnt,wrlen)  (*(a)->funcs.writev)(a,io,vec,cnt,wrlen)
-#define io_connect(a,io,rp,wp,ra,f)   (*(a)->funcs.connect)(a,io,rp,wp,ra,f)
-#define io_accept(a,io,rp,wp,f,l,r)   (*(a)->funcs.accept)(a,io,rp,wp,f,l,r)
-#define io_listen(a,io,rp,l,ru)          (*(a)->funcs.listen)(a,io,rp,l,ru)
-#define io_close(a,io)      (*(a)->funcs.close)(a,io)
+int io_poller_dispose(io_poller *poller);
+int io_poller_wait(io_poller *poller, unsigned int timeout);
+int io_poller_dispatch(io_poller *poller);
+int io_poller_post(io_poller *poller, io_post_proc proc, void *arg);
+int io_poller_post_node(io_poller *poller, io_post *node, io_post_proc proc, void *arg);
+int io_poller_rejected(io_poller *poller, io_poller_type backend);
+const char* io_poller_next_rejected(io_poller *poller, int *pos, int *err);
 
-#ifdef USE_MOCK
+#ifdef IO_STATIC_BACKEND
+
+#define IO_STATIC_FN(op)	IO_CAT(IO_CAT(io_,IO_STATIC_BACKEND),IO_CAT(_,op))
+#define IO_STATIC_DATA(a)	((a)->poller_data.IO_STATIC_BACKEND)
+#define io_fd_check(a)		IO_STATIC_FN(fd_check)(IO_STATIC_DATA(a))
+#define io_add(a,b,c)		IO_STATIC_FN(add)(IO_STATIC_DATA(a),b,c)
+#define io_remove(a,b)		IO_STATIC_FN(remove)(IO_STATIC_DATA(a),b)
+#define io_set(a,b,c)		IO_STATIC_FN(set)(IO_STATIC_DATA(a),b,c)
+#define io_read(a,io,buf,cnt,rdlen)   io_atom_read(a,io,buf,cnt,rdlen)
+#define io_readv(a,io,vec,cnt,rdlen)   io_atom_readv(a,io,vec,cnt,rdlen)
+#define io_write(a,io,buf,cnt,wrlen)  io_atom_write(a,io,buf,cnt,wrlen)
+#define io_writev(a,io,vec,cnt,wrlen)  io_atom_writev(a,io,vec,cnt,wrlen)
+#define io_connect(a,io,rp,wp,ra,f)   io_socket_connect(a,io,rp,wp,ra,f)
+#define io_accept(a,io,rp,wp,f,l,r)   io_socket_accept(a,io,rp,wp,f,l,r)
+#define io_listen(a,io,rp,l,ru)          io_socket_listen(a,io,rp,l,ru)
+#define io_close(a,io)      io_atom_close(a,io)
+#if IO_STATIC_ID == IO_STATIC_ID_uring
+#define io_submit(a,req)    io_uring_submit_request(a,req)
+#define io_cancel(a,req)    io_uring_cancel_request(a,req)
+#else
+#define io_submit(a,req)    io_stream_emulate_submit(a,req)
+#define io_cancel(a,req)    io_stream_emulate_cancel(a,req)
+#endif
+
+#else
+
+#define io_fd_check(a)		(*(a)->funcs->fd_check)((a)->poller_data.any)
+#define io_add(a,b,c)		(*(a)->funcs->add)((a)->poller_data.any,b,c)
+#define io_remove(a,b)		(*(a)->funcs->remove)((a)->poller_data.any,b)
+#define io_set(a,b,c)		(*(a)->funcs->set)((a)->poller_data.any,b,c)
+#define io_read(a,io,buf,cnt,rdlen)   (*(a)->funcs->read)(a,io,buf,cnt,rdlen)
+#define io_readv(a,io,vec,cnt,rdlen)   (*(a)->funcs->readv)(a,io,vec,cnt,rdlen)
+#define io_write(a,io,buf,cnt,wrlen)  (*(a)->funcs->write)(a,io,buf,cnt,wrlen)
+#define io_writev(a,io,vec,cnt,wrlen)  (*(a)->funcs->writev)(a,io,vec,cnt,wrlen)
+#define io_connect(a,io,rp,wp,ra,f)   (*(a)->funcs->connect)(a,io,rp,wp,ra,f)
+#define io_accept(a,io,rp,wp,f,l,r)   (*(a)->funcs->accept)(a,io,rp,wp,f,l,r)
+#define io_listen(a,io,rp,l,ru)          (*(a)->funcs->listen)(a,io,rp,l,ru)
+#define io_close(a,io)      (*(a)->funcs->close)(a,io)
+#define io_submit(a,req)    (*(a)->funcs->submit)(a,req)
+#define io_cancel(a,req)    (*(a)->funcs->cancel)(a,req)
+
+#endif
+
+#define io_wait(a,b)		io_poller_wait(a,b)
+#define io_dispatch(a)		io_poller_dispatch(a)
+#define io_poller_has(a,cap)	((a)->funcs->caps & (cap))
+
+#if defined(USE_MOCK) && !defined(IO_STATIC_BACKEND)
 #define io_is_mock(a)	((a)->poller_type == IO_POLLER_MOCK)
 #else
 #define io_is_mock(a)	0
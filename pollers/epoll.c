@@ -4,14 +4,15 @@
 //
 // Uses epoll to retrieve IO Atom events.
 
+#include "../poller.h"
+
 #ifdef USE_EPOLL
 
+#include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
 #include <values.h>
 
-#include "../poller.h"
-
 
 int io_epoll_init(io_epoll_poller *poller)
 {
@@ -21,7 +22,22 @@ int io_epoll_init(io_epoll_poller *poller)
 	// hard-coding 1024!
 	poller->epfd = epoll_create(1024);
 	if(poller->epfd < 0) {
-		return poller->epfd;
+		return errno ? errno : -1;
+	}
+
+	poller->min_batch = IO_EPOLL_MIN_EVENTS;
+	poller->max_batch = IO_EPOLL_MAX_EVENTS;
+	poller->batch_size = IO_EPOLL_INIT_EVENTS;
+	poller->next_batch = IO_EPOLL_INIT_EVENTS;
+	poller->idle_waits = 0;
+	poller->full_batches = 0;
+	poller->cnt_fd = 0;
+	poller->dispatching = -1;
+
+	poller->events = malloc(poller->batch_size * sizeof(struct epoll_event));
+	if(!poller->events) {
+		close(poller->epfd);
+		return ENOMEM;
 	}
 
 	/*
@@ -51,6 +67,9 @@ int io_epoll_init(io_epoll_poller *poller)
 
 int io_epoll_poller_dispose(io_epoll_poller *poller)
 {
+	free(poller->events);
+	poller->events = NULL;
+
 	if(close(poller->epfd)) {
 		return errno ? errno : -1;
 	}
@@ -109,6 +128,18 @@ int io_epoll_remove(io_epoll_poller *poller, io_atom *atom)
 {
 	// Linux has been able to handle a NULL event only since 2.6.9.
 	struct epoll_event event;
+	int i;
+
+	// the atom is probably about to be freed.  Make sure dispatch
+	// doesn't call it again, for this event or a later one.
+	if(poller->dispatching >= 0) {
+		for(i=poller->dispatching; i<poller->cnt_fd; i++) {
+			if(poller->events[i].data.ptr == atom) {
+				poller->events[i].data.ptr = NULL;
+			}
+		}
+	}
+
 	if(epoll_ctl(poller->epfd, EPOLL_CTL_DEL, atom->fd, &event)) {
 		return errno ? errno : -1;
 	}
@@ -116,6 +147,53 @@ int io_epoll_remove(io_epoll_poller *poller, io_atom *atom)
 }
 
 
+// Decides how big the next batch should be based on how full
+// this one was.  The resize itself happens in the next wait (we can't
+// touch the events array until it has been dispatched).
+
+static void adapt_batch(io_epoll_poller *poller)
+{
+	if(poller->cnt_fd >= poller->batch_size) {
+		// there are probably more events waiting.  go bigger.
+		poller->full_batches += 1;
+		poller->idle_waits = 0;
+		if(poller->batch_size < poller->max_batch) {
+			poller->next_batch = poller->batch_size * 2;
+		}
+		return;
+	}
+
+	if(poller->cnt_fd < poller->batch_size / 4) {
+		poller->idle_waits += 1;
+		if(poller->idle_waits >= IO_EPOLL_SHRINK_WAITS && poller->batch_size > poller->min_batch) {
+			poller->next_batch = poller->batch_size / 2;
+			poller->idle_waits = 0;
+		}
+	} else {
+		poller->idle_waits = 0;
+	}
+}
+
+
+static void resize_batch(io_epoll_poller *poller)
+{
+	struct epoll_event *events;
+	int size = poller->next_batch;
+
+	if(size > poller->max_batch) size = poller->max_batch;
+	if(size < poller->min_batch) size = poller->min_batch;
+	if(size < 1) size = 1;
+
+	// if realloc fails we just carry on with the old batch.
+	events = realloc(poller->events, size * sizeof(struct epoll_event));
+	if(events) {
+		poller->events = events;
+		poller->batch_size = size;
+	}
+	poller->next_batch = poller->batch_size;
+}
+
+
 int io_epoll_wait(io_epoll_poller *poller, unsigned int timeout)
 {
 	int to;
@@ -125,15 +203,21 @@ int io_epoll_wait(io_epoll_poller *poller, unsigned int timeout)
 	} else {
 		to = timeout;
 	}
+
+	if(poller->next_batch != poller->batch_size) {
+		resize_batch(poller);
+	}
 	
-	poller->cnt_fd = epoll_wait(poller->epfd, poller->events, IO_EPOLL_MAX_EVENTS, to);
+	poller->cnt_fd = epoll_wait(poller->epfd, poller->events, poller->batch_size, to);
     if(poller->cnt_fd < 0) {
         // it's not an error if we were interrupted.
         if(errno == EINTR) {
             poller->cnt_fd = 0;
         }
+        return poller->cnt_fd;
     }
 
+	adapt_batch(poller);
 	return poller->cnt_fd;
 }
 
@@ -142,21 +226,31 @@ int io_epoll_dispatch(struct io_poller *base_poller)
 {
 	int i, max, events;
 	io_atom *atom;
-	io_epoll_poller *poller = &base_poller->poller_data.epoll;
-	    
-    max = poller->cnt_fd;
-    for(i=0; i < max; i++) {
-    	atom = (io_atom*)poller->events[i].data.ptr;
-    	events = poller->events[i].events;
-    	if(events & EPOLLIN) {
-    		(*atom->read_proc)(base_poller, atom);
-    	}
-    	if(events & EPOLLOUT) {
-    		(*atom->write_proc)(base_poller, atom);
-    	}
-    }
-    
-    return 0;
+	io_epoll_poller *poller = base_poller->poller_data.epoll;
+	struct epoll_event *event;
+
+	// Any proc may remove its own atom or one later in the batch.
+	// io_epoll_remove clears the atom out of the events that haven't
+	// been dispatched yet so check it before every call.
+	max = poller->cnt_fd;
+	for(i=0; i < max; i++) {
+		event = &poller->events[i];
+		poller->dispatching = i;
+		atom = (io_atom*)event->data.ptr;
+		events = event->events;
+		if(atom && (events & EPOLLERR) && atom->error_proc) {
+			(*atom->error_proc)(base_poller, atom);
+		}
+		if(event->data.ptr && (events & EPOLLIN)) {
+			(*atom->read_proc)(base_poller, atom);
+		}
+		if(event->data.ptr && (events & EPOLLOUT)) {
+			(*atom->write_proc)(base_poller, atom);
+		}
+	}
+	poller->dispatching = -1;
+
+	return 0;
 }
 
 #endif
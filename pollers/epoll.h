@@ -5,13 +5,40 @@
 #include <sys/epoll.h>
 #include "../atom.h"
 
-// TODO: make this dynamic
-#define IO_EPOLL_MAX_EVENTS 128
+// The number of events retrieved by each epoll_wait adapts to the load.
+// It starts at IO_EPOLL_INIT_EVENTS, doubles every time a wait returns
+// a full batch (up to max_batch), and halves when IO_EPOLL_SHRINK_WAITS
+// waits in a row use less than a quarter of it (down to min_batch).
+// Read batch_size and full_batches from poller_data.epoll-> when tuning.
+
+#ifndef IO_EPOLL_INIT_EVENTS
+#define IO_EPOLL_INIT_EVENTS 128
+#endif
+
+#ifndef IO_EPOLL_MIN_EVENTS
+#define IO_EPOLL_MIN_EVENTS 32
+#endif
+
+#ifndef IO_EPOLL_MAX_EVENTS
+#define IO_EPOLL_MAX_EVENTS 16384
+#endif
+
+#ifndef IO_EPOLL_SHRINK_WAITS
+#define IO_EPOLL_SHRINK_WAITS 64
+#endif
 
 struct io_epoll_poller {
 	int epfd;
 	int cnt_fd;
-	struct epoll_event events[IO_EPOLL_MAX_EVENTS];
+	struct epoll_event *events;
+	int dispatching;	///< the index of the event being dispatched, or -1.
+
+	int batch_size;		///< the number of events the next epoll_wait can return.
+	int min_batch;		///< batch_size never shrinks below this.  You may change it after init.
+	int max_batch;		///< batch_size never grows above this.  You may change it after init.
+	int next_batch;		///< the batch size that the next wait will resize to.
+	int idle_waits;		///< consecutive waits that used less than a quarter of the batch.
+	unsigned long full_batches;	///< the number of waits that returned a full batch.
 };
 typedef struct io_epoll_poller io_epoll_poller;
 
@@ -225,6 +225,7 @@ static int find_event_by_socket_addr(io_mock_poller *poller, const socket_addr i
 {
 	socket_addr tmpaddr;
 	const char *errstr;
+	char buf[IO_ADDRSTRLEN];
 	int i, num_previous_events;
 	
 	num_previous_events = 0;
@@ -239,12 +240,13 @@ static int find_event_by_socket_addr(io_mock_poller *poller, const socket_addr i
 						"(you can specify an integer after the address to return an error).",
 						func, describe_event(poller, &poller->event_sets[i]));
 			}
+			io_addr_any(&tmpaddr, 0);
 			errstr = io_parse_address(poller->event_sets[i].data, &tmpaddr);
 			if(errstr) {
 				die(poller, errstr, poller->event_sets[i].data);
 			}
 			
-			if((tmpaddr.addr.s_addr == inaddr.addr.s_addr) && (tmpaddr.port == inaddr.port)) {
+			if(io_addr_equal(&tmpaddr, &inaddr)) {
 				if(poller->events_handled_in_last_set & (1<<i)) {
 					// found a matching event but it's already been used...
 					// keep searching.
@@ -258,9 +260,9 @@ static int find_event_by_socket_addr(io_mock_poller *poller, const socket_addr i
 		}
 	}
 
-	die(poller, "%s: could not find unused event corresponding to %s:%d "
+	die(poller, "%s: could not find unused event corresponding to %s "
 			"(%d matching events were previously handled)", func,
-			inet_ntoa(inaddr.addr), inaddr.port, num_previous_events);
+			io_addr_format(&inaddr, buf, sizeof(buf)), num_previous_events);
 	
 	return -1;
 }
@@ -520,7 +522,7 @@ static void done_with_event(struct io_mock_poller *poller, mock_event_tracker *s
 static int dispatch_atom(struct io_poller *base_poller, const mock_event *event, mockfd *mfd, int flag)
 {
 	mock_event_tracker storage;
-	io_mock_poller *poller = &base_poller->poller_data.mock;
+	io_mock_poller *poller = base_poller->poller_data.mock;
 	const char *op = (flag & IO_READ ? "read" : "write");
 	
 	using_event(poller, event, &storage, "io_dispatch");
@@ -554,7 +556,7 @@ static int dispatch_atom(struct io_poller *base_poller, const mock_event *event,
 
 int io_mock_dispatch(struct io_poller *base_poller)
 {
-	io_mock_poller *poller = &base_poller->poller_data.mock;
+	io_mock_poller *poller = base_poller->poller_data.mock;
 	const mock_event *event;
 	mockfd *mfd;
 	int i, err;
@@ -657,7 +659,7 @@ static int find_io_event(io_mock_poller *poller, io_atom *io, mock_event_type ty
 int io_mock_read(struct io_poller *base_poller, struct io_atom *io, char *buf, size_t cnt, size_t *readlen)
 {
 	static const char *func = "io_read";
-	io_mock_poller *poller = &base_poller->poller_data.mock;
+	io_mock_poller *poller = base_poller->poller_data.mock;
 	mock_event_tracker storage;
 	mockfd *mfd;
 	const mock_event *event;
@@ -728,7 +730,7 @@ static void copy_readv_data(io_mock_poller *poller, const mock_event *event, con
 int io_mock_readv(struct io_poller *base_poller, struct io_atom *io, const struct iovec *vec, int cnt, size_t *readlen)
 {
 	static const char *func = "io_readv";
-	io_mock_poller *poller = &base_poller->poller_data.mock;
+	io_mock_poller *poller = base_poller->poller_data.mock;
 	mock_event_tracker storage;
 	mockfd *mfd;
 	const mock_event *event;
@@ -761,7 +763,7 @@ int io_mock_readv(struct io_poller *base_poller, struct io_atom *io, const struc
 int io_mock_write(struct io_poller *base_poller, struct io_atom *io, const char *buf, size_t cnt, size_t *wrlen)
 {
 	static const char *func = "io_write";
-	io_mock_poller *poller = &base_poller->poller_data.mock;
+	io_mock_poller *poller = base_poller->poller_data.mock;
 	mock_event_tracker storage;
 	mockfd *mfd;
 	const mock_event *event;
@@ -835,7 +837,7 @@ static void verify_writev_data(io_mock_poller *poller, const mock_event *event,
 int io_mock_writev(struct io_poller *base_poller, struct io_atom *io, const struct iovec *vec, int cnt, size_t *wrlen)
 {
 	static const char *func = "io_write";
-	io_mock_poller *poller = &base_poller->poller_data.mock;
+	io_mock_poller *poller = base_poller->poller_data.mock;
 	mock_event_tracker storage;
 	mockfd *mfd;
 	const mock_event *event;
@@ -861,15 +863,14 @@ void parse_socket_address(io_mock_poller *poller, socket_addr *saddr, const char
 	const char *errstr;
 
 	// find address where connection is originating from.
-	saddr->addr.s_addr = htonl(INADDR_ANY);
-	saddr->port = -1;
+	io_addr_any(saddr, 0);
 	
 	errstr = io_parse_address(str, saddr);
 	if(errstr) {
 		die(poller, errstr, str);
 	}
 	
-	if(saddr->port == -1) {
+	if(io_addr_port(saddr) == 0) {
 		die(poller, "port number is required but one wasn't found in %s!", str);
 	}
 }
@@ -878,10 +879,11 @@ void parse_socket_address(io_mock_poller *poller, socket_addr *saddr, const char
 int io_mock_connect(struct io_poller *base_poller, io_atom *io, io_proc read_proc, io_proc write_proc, socket_addr remote, int flags)
 {
 	static const char *func = "io_connect";
-	io_mock_poller *poller = &base_poller->poller_data.mock;
+	io_mock_poller *poller = base_poller->poller_data.mock;
 	mock_event_tracker storage;
 	const mock_event *event;
 	socket_addr tmpaddr;
+	char buf[IO_ADDRSTRLEN], buf2[IO_ADDRSTRLEN];
 	int fd, err;
 	
 	io_atom_init(io, -1, NULL, NULL);
@@ -901,10 +903,10 @@ int io_mock_connect(struct io_poller *base_poller, io_atom *io, io_proc read_pro
 	// addresses are not the same (since the code can't currently retrieve
 	// the originating address of the socket, this is only academic for now).
 	parse_socket_address(poller, &tmpaddr, event->remote->source_address);
-	if((tmpaddr.addr.s_addr == remote.addr.s_addr) && (tmpaddr.port == remote.port)) {
-		die(poller, "%s: event's originating address %s:%d needs to be different from its destination address %s:%d for %s", func,
-				inet_ntoa(tmpaddr.addr), tmpaddr.port,
-				inet_ntoa(remote.addr), remote.port,
+	if(io_addr_equal(&tmpaddr, &remote)) {
+		die(poller, "%s: event's originating address %s needs to be different from its destination address %s for %s", func,
+				io_addr_format(&tmpaddr, buf, sizeof(buf)),
+				io_addr_format(&remote, buf2, sizeof(buf2)),
 				describe_event(poller,event));
 	}
 	
@@ -912,8 +914,8 @@ int io_mock_connect(struct io_poller *base_poller, io_atom *io, io_proc read_pro
 	io_atom_init(io, fd, read_proc, write_proc);
 	mock_fd_install(poller, fd, io, event->remote, flags, 0);
 	
-	info(poller, "%s: opened fd %d to %s:%d",
-			func, fd, inet_ntoa(remote.addr), remote.port);
+	info(poller, "%s: opened fd %d to %s",
+			func, fd, io_addr_format(&remote, buf, sizeof(buf)));
 
 	done_with_event(poller, &storage);
 	
@@ -924,13 +926,13 @@ int io_mock_connect(struct io_poller *base_poller, io_atom *io, io_proc read_pro
 int io_mock_accept(struct io_poller *base_poller, io_atom *io, io_proc read_proc, io_proc write_proc, int flags, io_atom *listener, socket_addr *remote)
 {
 	static const char *func = "io_accept";
-	io_mock_poller *poller = &base_poller->poller_data.mock;
+	io_mock_poller *poller = base_poller->poller_data.mock;
 	mock_event_tracker storage;
 	const mock_event *event;
 	int fd, err;
 	mockfd *mfd;
 	socket_addr toaddr, fromaddr;
-	char buf[512];
+	char buf[IO_ADDRSTRLEN], buf2[IO_ADDRSTRLEN];
 	
 	io_atom_init(io, -1, NULL, NULL);
 	err = find_mockfd_by_atom(poller, listener, &mfd, func);
@@ -967,31 +969,30 @@ int io_mock_accept(struct io_poller *base_poller, io_atom *io, io_proc read_proc
 	}
 	
 	// sanity check: make sure the source and destination addresses aren't the same.
-	if((fromaddr.addr.s_addr == toaddr.addr.s_addr) && (fromaddr.port == toaddr.port)) {
-		die(poller, "%s: event source address %s:%d needs to be different from its destination address %s:%d for %s", func,
-				inet_ntoa(fromaddr.addr), fromaddr.port,
-				inet_ntoa(toaddr.addr), toaddr.port,
+	if(io_addr_equal(&fromaddr, &toaddr)) {
+		die(poller, "%s: event source address %s needs to be different from its destination address %s for %s", func,
+				io_addr_format(&fromaddr, buf, sizeof(buf)),
+				io_addr_format(&toaddr, buf2, sizeof(buf2)),
 				describe_event(poller,event));
 	}
 	
-	// hack to get around inet_ntoa's use of a static buffer...
-	strncpy(buf, inet_ntoa(toaddr.addr), sizeof(buf));
-	buf[sizeof(buf)-1] = '\0';
-	info(poller, "%s: opened fd %d for inbound connection to %s:%d from %s:%d",
-			func, fd, buf, toaddr.port, inet_ntoa(fromaddr.addr), fromaddr.port);
+	info(poller, "%s: opened fd %d for inbound connection to %s from %s",
+			func, fd, io_addr_format(&toaddr, buf, sizeof(buf)),
+			io_addr_format(&fromaddr, buf2, sizeof(buf2)));
 	
 	done_with_event(poller, &storage);
 	return 0;
 }
 
 
-int io_mock_listen(struct io_poller *base_poller, io_atom *io, io_proc read_proc, socket_addr local, int reuse_addr)
+int io_mock_listen(struct io_poller *base_poller, io_atom *io, io_proc read_proc, socket_addr local, int flags)
 {
 	static const char *func = "io_listen";
-	io_mock_poller *poller = &base_poller->poller_data.mock;
+	io_mock_poller *poller = base_poller->poller_data.mock;
 	mock_event_tracker storage;
 	const mock_event *event;
 	socket_addr tmpaddr;
+	char buf[IO_ADDRSTRLEN], buf2[IO_ADDRSTRLEN];
 	int fd, err;
 	
 	io_atom_init(io, -1, NULL, NULL);
@@ -1009,10 +1010,10 @@ int io_mock_listen(struct io_poller *base_poller, io_atom *io, io_proc read_proc
 	// quick sanity check to ensure that the originating and destination
 	// addresses are the same (this is only true for listening sockets).
 	parse_socket_address(poller, &tmpaddr, event->remote->source_address);
-	if((tmpaddr.addr.s_addr != local.addr.s_addr) || (tmpaddr.port != local.port)) {
-		die(poller, "%s: event listen address %s:%d needs to match its connection address %s:%d for %s", func,
-				inet_ntoa(tmpaddr.addr), tmpaddr.port,
-				inet_ntoa(local.addr), local.port,
+	if(!io_addr_equal(&tmpaddr, &local)) {
+		die(poller, "%s: event listen address %s needs to match its connection address %s for %s", func,
+				io_addr_format(&tmpaddr, buf, sizeof(buf)),
+				io_addr_format(&local, buf2, sizeof(buf2)),
 				describe_event(poller,event));
 	}
 
@@ -1033,7 +1034,7 @@ int io_mock_listen(struct io_poller *base_poller, io_atom *io, io_proc read_proc
 int io_mock_close(struct io_poller *base_poller, io_atom *io)
 {
 	static const char *func = "io_close";
-	io_mock_poller *poller = &base_poller->poller_data.mock;
+	io_mock_poller *poller = base_poller->poller_data.mock;
 	mockfd *mfd;
 	const mock_event *event;
 	mock_event_tracker storage;
@@ -1065,7 +1066,7 @@ int io_mock_close(struct io_poller *base_poller, io_atom *io)
 
 int io_mock_set_events(io_poller *base_poller, const mock_event_queue *events)
 {
-	io_mock_poller *poller = &base_poller->poller_data.mock;
+	io_mock_poller *poller = base_poller->poller_data.mock;
 	int event_capacity;
 	int n_events;
 	
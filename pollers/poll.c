@@ -5,31 +5,40 @@
 
 // TODO: could adding POLLRDHUP, POLLERR, or POLLHUP help?
 
+#include "../poller.h"
+
 #ifdef USE_POLL
 
 #include <stddef.h>
+#include <stdlib.h>
 #include <errno.h>
+#include <limits.h>
 #include <sys/poll.h>
-#include <values.h>
-
-#include "../poller.h"
 
 
 int io_poll_init(io_poll_poller *poller)
 {
-	// TODO: right now max_fd only goes up in value.
-	// we should add some better heuristics/ordering so we don't have to
-	// do a full linear search every time someone calls io_add,
-	// and so max_fd can decrease when the number of simultaneous
-	// connections reduces.
 	poller->num_pfds = 0;
+	poller->cnt_fd = 0;
+	poller->dispatching = 0;
+	poller->num_free = 0;
+	poller->fd_map = NULL;
+	poller->fd_map_size = 0;
+
+	// make sure we're allowed to call poll (seccomp might say no).
+	if(poll(NULL, 0, 0) < 0) {
+		return errno;
+	}
+
 	return 0;
 }
 
 
 int io_poll_poller_dispose(io_poll_poller *poller)
 {
-	// nothing to dispose of
+	free(poller->fd_map);
+	poller->fd_map = NULL;
+	poller->fd_map_size = 0;
 	return 0;
 }
 
@@ -54,105 +63,199 @@ static int get_events(int flags)
 }
 
 
-// Scans through the set of polled fds looking for the given fd.
-// If avail points to an int, then the first available slot is
-// returned.  If no slots are available, *avail is set to -1.
+// Returns the index of fd in pfds or -1 if it's not being polled.
 
-static int find_fd(io_poll_poller *poller, int fd, int *avail)
+static int find_fd(io_poll_poller *poller, int fd)
 {
-	int i, max;
-	
-	if(avail) {
-		*avail = -1;
+	if(fd >= poller->fd_map_size) {
+		return -1;
 	}
-	
-	for(i=0, max=poller->num_pfds; i<max; i++) {
-		if(poller->pfds[i].fd == fd) {
-			return i;
+	return poller->fd_map[fd];
+}
+
+
+// Makes sure fd_map is big enough to hold fd.
+
+static int grow_map(io_poll_poller *poller, int fd)
+{
+	int *map;
+	int i, size;
+
+	if(fd < poller->fd_map_size) {
+		return 0;
+	}
+
+	size = poller->fd_map_size ? poller->fd_map_size : 64;
+	while(size <= fd) {
+		size *= 2;
+	}
+
+	map = realloc(poller->fd_map, size * sizeof(int));
+	if(!map) {
+		return ENOMEM;
+	}
+
+	for(i=poller->fd_map_size; i<size; i++) {
+		map[i] = -1;
+	}
+	poller->fd_map = map;
+	poller->fd_map_size = size;
+	return 0;
+}
+
+
+// Moves the pfd at index from to index to.
+
+static void move_pfd(io_poll_poller *poller, int from, int to)
+{
+	poller->pfds[to] = poller->pfds[from];
+	poller->connections[to] = poller->connections[from];
+	poller->fd_map[poller->pfds[to].fd] = to;
+}
+
+
+// Fills the holes left by removals during dispatch with pfds
+// from the end of the array.
+
+static void compact(io_poll_poller *poller)
+{
+	int hole;
+
+	while(poller->num_free > 0) {
+		while(poller->num_pfds > 0 && poller->pfds[poller->num_pfds-1].fd < 0) {
+			poller->num_pfds -= 1;
 		}
-		if(avail && poller->pfds[i].fd == -1) {
-			*avail = i;
-			avail = NULL;
+
+		hole = poller->free_slots[--poller->num_free];
+		if(hole < poller->num_pfds) {
+			poller->num_pfds -= 1;
+			move_pfd(poller, poller->num_pfds, hole);
 		}
 	}
-	
-	return -1;
 }
 
 
 int io_poll_add(io_poll_poller *poller, io_atom *atom, int flags)
 {
-	int index, avail_fd;
+	int index, err;
 	
 	if(atom->fd < 0) {
 		return ERANGE;
 	}
 	
-	index = find_fd(poller, atom->fd, &avail_fd);
-	if(index >= 0) {
+	if(find_fd(poller, atom->fd) >= 0) {
 		// this fd is already being monitored!
 		return EALREADY;
 	}
+
+	if(poller->num_free == 0 && poller->num_pfds >= IO_POLL_MAX_FDS) {
+		return EMFILE;
+	}
+
+	err = grow_map(poller, atom->fd);
+	if(err) {
+		return err;
+	}
 	
-	if(avail_fd == -1) {
-		// if no available fds, we need to allocate another one
-		if(poller->num_pfds > IO_POLL_MAX_FDS) {
-			return -EMFILE;
-		}
+	if(poller->num_free > 0) {
+		index = poller->free_slots[--poller->num_free];
+	} else {
 		index = poller->num_pfds;
 		poller->num_pfds += 1;
 	}
 		
 	poller->pfds[index].fd = atom->fd;
 	poller->pfds[index].events = get_events(flags);
+	poller->pfds[index].revents = 0;
 	poller->connections[index] = atom;
+	poller->fd_map[atom->fd] = index;
 	
 	return 0;
 }
 
 
-static int poll_find(io_poll_poller *poller, int fd, int *index)
+int io_poll_set(io_poll_poller *poller, io_atom *atom, int flags)
 {
-	int err;
-	
-	if(fd < 0) {
+	int index;
+
+	if(atom->fd < 0) {
 		return ERANGE;
 	}
-	
-	err = find_fd(poller, fd, NULL);
+
+	index = find_fd(poller, atom->fd);
 	if(index < 0) {
 		return EEXIST;
 	}
 	
-	*index = err;
+	poller->pfds[index].events = get_events(flags);
 	return 0;
 }
 
 
-int io_poll_set(io_poll_poller *poller, io_atom *atom, int flags)
+int io_poll_remove(io_poll_poller *poller, io_atom *atom)
 {
 	int index;
-	int err = poll_find(poller, atom->fd, &index);
-	if(err) {
-		return err;
+
+	if(atom->fd < 0) {
+		return ERANGE;
 	}
-	
-	poller->pfds[index].events = get_events(flags);
+
+	index = find_fd(poller, atom->fd);
+	if(index < 0) {
+		return EALREADY;
+	}
+
+	poller->fd_map[atom->fd] = -1;
+	poller->pfds[index].fd = -1;
+	poller->pfds[index].revents = 0;
+	poller->connections[index] = NULL;
+	poller->generations[index] += 1;
+	poller->free_slots[poller->num_free++] = index;
+
+	if(!poller->dispatching) {
+		compact(poller);
+	}
+
 	return 0;
 }
 
 
-int io_poll_remove(io_poll_poller *poller, io_atom *atom)
+// Collects the pfds that have events into the ready list.  poll
+// told us how many there are so we can stop as soon as we've seen them.
+
+static void collect(io_poll_poller *poller)
 {
-	int index;
-	int err = poll_find(poller, atom->fd, &index);
-	if(err) {
-		return err;
+	struct io_poll_ready *ready = poller->ready;
+	int i, max, events, left = poller->cnt_fd;
+
+	poller->num_ready = 0;
+	for(i=0, max=poller->num_pfds; i<max && left>0; i++) {
+		events = poller->pfds[i].revents;
+		if(!events) {
+			continue;
+		}
+		poller->pfds[i].revents = 0;
+		left -= 1;
+
+		// hangups and errors are reported whether we asked or not.
+		// Let the procs find out about them by reading or writing
+		// unless the atom wants errors delivered to its error_proc.
+		if((events & POLLHUP) || ((events & POLLERR) && !poller->connections[i]->error_proc)) {
+			events |= poller->pfds[i].events;
+		}
+
+		ready->slot = i;
+		ready->events = events;
+		ready->atom = poller->connections[i];
+		ready->generation = poller->generations[i];
+		ready += 1;
+	}
+
+	poller->num_ready = ready - poller->ready;
+	if(poller->num_ready) {
+		// don't let removals move slots around until they're dispatched.
+		poller->dispatching = 1;
 	}
-	
-	poller->pfds[index].fd = -1;
-	poller->connections[index] = NULL;
-	return 0;
 }
 
 
@@ -166,6 +269,7 @@ int io_poll_wait(io_poll_poller *poller, unsigned int timeout)
 		to = timeout;
 	}
 	
+	poller->num_ready = 0;
 	poller->cnt_fd = poll(poller->pfds, poller->num_pfds, to);
 	if(poller->cnt_fd < 0) {
         // it's not an error if we were interrupted.
@@ -173,6 +277,10 @@ int io_poll_wait(io_poll_poller *poller, unsigned int timeout)
             poller->cnt_fd = 0;
         }
 	}
+
+	if(poller->cnt_fd > 0) {
+		collect(poller);
+	}
 	
 	return poller->cnt_fd;
 }
@@ -180,31 +288,36 @@ int io_poll_wait(io_poll_poller *poller, unsigned int timeout)
 
 int io_poll_dispatch(struct io_poller *base_poller)
 {
-	int i, max, events;
+	int i;
 	io_atom *atom;
-	io_poll_poller *poller = &base_poller->poller_data.poll;
-	
-    if(poller->cnt_fd <= 0) {
-    	return 0;
-    }
-    
-    max = poller->cnt_fd;
-    for(i=0, max=poller->num_pfds; i<max; i++) {
-    	events = poller->pfds[i].revents;
-    	if(events) {
-    		poller->pfds[i].revents = 0;
-    		atom = poller->connections[i];
-    		if(events | POLLIN) {
-    			 (*atom->read_proc)(base_poller, atom);
-    		}
-    		if(events | POLLOUT)  {
-    			 (*atom->write_proc)(base_poller, atom);
-    		}
-    	}
-    }
-    
-    return 0;
+	unsigned int *gen;
+	struct io_poll_ready *ready;
+	io_poll_poller *poller = base_poller->poller_data.poll;
+
+	// A proc may remove any atom, including ones later in the ready
+	// list.  Removed slots are left empty until we're done but an add
+	// may refill one, possibly with the same atom (free_slots is a
+	// stack), so an entry is only dispatched if its slot hasn't been
+	// emptied since the events were collected.
+	for(i=0; i<poller->num_ready; i++) {
+		ready = &poller->ready[i];
+		atom = ready->atom;
+		gen = &poller->generations[ready->slot];
+		if((ready->events & POLLERR) && *gen == ready->generation && atom->error_proc) {
+			(*atom->error_proc)(base_poller, atom);
+		}
+		if((ready->events & POLLIN) && *gen == ready->generation) {
+			(*atom->read_proc)(base_poller, atom);
+		}
+		if((ready->events & POLLOUT) && *gen == ready->generation) {
+			(*atom->write_proc)(base_poller, atom);
+		}
+	}
+	poller->num_ready = 0;
+	poller->dispatching = 0;
+
+	compact(poller);
+	return 0;
 }
 
 #endif
-
@@ -11,10 +11,35 @@
 #endif
 
 
+// An fd that poll reported events on, waiting to be dispatched.
+struct io_poll_ready {
+	int slot;		// the fd's index in pfds.
+	int events;		// its revents.
+	io_atom *atom;	// the atom in the slot when the events were collected.
+	unsigned int generation;	// the slot's generation when the events were collected.
+};
+
+
 struct io_poll_poller {
-	int num_pfds;	// the index plus one of the last pfd in the array.
+	int num_pfds;	// the number of pfds in use, including holes left during dispatch.
 	int cnt_fd;		// the number of fds that have events on them (set by io_poll_wait()).	
+	int dispatching;	// set from the time io_poll_wait collects events until they're dispatched.
+
+	// Removing an fd normally moves the last pfd into its slot so the
+	// array stays packed.  That can't happen during dispatch (it would
+	// invalidate the slot numbers in the ready list) so the slot is left as a
+	// hole and the array is compacted once dispatch is finished.
+	int num_free;
+	int free_slots[IO_POLL_MAX_FDS];
+
+	int *fd_map;	// fd_map[fd] is fd's index in pfds, or -1.
+	int fd_map_size;
+
+	int num_ready;	// the number of entries in ready.
+	struct io_poll_ready ready[IO_POLL_MAX_FDS];
+
 	io_atom* connections[IO_POLL_MAX_FDS];
+	unsigned int generations[IO_POLL_MAX_FDS];	// bumped every time a slot is emptied.
 	struct pollfd pfds[IO_POLL_MAX_FDS];      
 };
 typedef struct io_poll_poller io_poll_poller;
@@ -28,4 +53,3 @@ int io_poll_set(io_poll_poller *poller, io_atom *atom, int flags);
 int io_poll_remove(io_poll_poller *poller, io_atom *atom);
 int io_poll_wait(io_poll_poller *poller, unsigned int timeout);
 int io_poll_dispatch(struct io_poller *poller);
-
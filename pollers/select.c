@@ -3,7 +3,7 @@
 // 4 October 2003
 //
 // Uses select to poll for I/O events.
-// Because of select's internal limitations, MAXFDS is 1024.
+// The fd sets are sized dynamically so we're not limited to FD_SETSIZE.
 
 
 // TODO: should probably make thread-safe by passing a global
@@ -14,28 +14,54 @@
 #ifdef USE_SELECT
 
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <limits.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
 
-// Pass the file descriptor that you'll be listening and accepting on.
+#define WORD_BITS IO_SELECT_WORD_BITS
+#define WORD(fd) ((fd) / WORD_BITS)
+#define BIT(fd) ((io_select_word)1 << ((fd) % WORD_BITS))
+#define BIT_SET(set,fd) ((set)[WORD(fd)] |= BIT(fd))
+#define BIT_CLR(set,fd) ((set)[WORD(fd)] &= ~BIT(fd))
+#define BIT_ISSET(set,fd) ((set)[WORD(fd)] & BIT(fd))
+
+
+static void reset(io_select_poller *poller)
+{
+	poller->connections = NULL;
+	poller->fd_read = poller->fd_write = NULL;
+	poller->gfd_read = poller->gfd_write = NULL;
+	poller->num_words = 0;
+	poller->max_fd = -1;
+	poller->cnt_fd = 0;
+}
+
 
 int io_select_init(io_select_poller *poller)
 {
-	poller->max_fd = 0;
+	struct timeval tv = { 0, 0 };
 
-	FD_ZERO(&poller->fd_read);
-	FD_ZERO(&poller->fd_write);
+	// make sure we're allowed to call select (seccomp might say no).
+	if(select(0, NULL, NULL, NULL, &tv) < 0) {
+		return errno;
+	}
 
+	reset(poller);
 	return 0;
 }
 
 
 int io_select_poller_dispose(io_select_poller *poller)
 {
-	// nothing to dispose of
+	free(poller->connections);
+	free(poller->fd_read);
+	free(poller->fd_write);
+	free(poller->gfd_read);
+	free(poller->gfd_write);
+	reset(poller);
 	return 0;
 }
 
@@ -46,7 +72,7 @@ int io_select_fd_check(io_select_poller *poller)
 	int i;
 
 	// Check that we haven't leaked any atoms.
-	for(i=0; i<FD_SETSIZE; i++) {
+	for(i=0; i<=poller->max_fd; i++) {
 		if(poller->connections[i]) {
 // TODO: need to figure out some other way of returning this info to the caller.
 //			fprintf(stderr, "Leaked atom fd=%d proc=%08lX!\n", i, (long)poller->connections[i]);
@@ -58,18 +84,60 @@ int io_select_fd_check(io_select_poller *poller)
 }
 
 
+static int grow_array(void **array, size_t old_size, size_t new_size)
+{
+	char *p = realloc(*array, new_size);
+	if(!p) {
+		return ENOMEM;
+	}
+	memset(p + old_size, 0, new_size - old_size);
+	*array = p;
+	return 0;
+}
+
+
+// Makes the bitmaps and connection table big enough to hold fd.
+// They only ever grow as far as the highest fd that has been added.
+
+static int grow(io_select_poller *poller, int fd)
+{
+	size_t old_words = poller->num_words;
+	size_t new_words = WORD(fd) + 1;
+	size_t ws = sizeof(io_select_word);
+
+	if(new_words <= old_words) {
+		return 0;
+	}
+
+	// If any of these fail, the ones that succeeded are just a little
+	// bigger than they need to be.  num_words remains correct.
+	if(grow_array((void**)&poller->fd_read, old_words*ws, new_words*ws) ||
+		grow_array((void**)&poller->fd_write, old_words*ws, new_words*ws) ||
+		grow_array((void**)&poller->gfd_read, old_words*ws, new_words*ws) ||
+		grow_array((void**)&poller->gfd_write, old_words*ws, new_words*ws) ||
+		grow_array((void**)&poller->connections, old_words*WORD_BITS*sizeof(io_atom*),
+			new_words*WORD_BITS*sizeof(io_atom*)))
+	{
+		return ENOMEM;
+	}
+
+	poller->num_words = new_words;
+	return 0;
+}
+
+
 static void install(io_select_poller *poller, int fd, int flags)
 {
 	if(flags & IO_READ) {
-		FD_SET(fd, &poller->fd_read);
+		BIT_SET(poller->fd_read, fd);
 	} else {
-		FD_CLR(fd, &poller->fd_read);
+		BIT_CLR(poller->fd_read, fd);
 	}
 
 	if(flags & IO_WRITE) {
-		FD_SET(fd, &poller->fd_write);
+		BIT_SET(poller->fd_write, fd);
 	} else {
-		FD_CLR(fd, &poller->fd_write);
+		BIT_CLR(poller->fd_write, fd);
 	}
 
 }
@@ -78,14 +146,20 @@ static void install(io_select_poller *poller, int fd, int flags)
 int io_select_add(io_select_poller *poller, io_atom *atom, int flags)
 {
 	int fd = atom->fd;
+	int err;
 
-	if(fd < 0 || fd >= FD_SETSIZE) {
+	if(fd < 0) {
 		return ERANGE;
 	}
-	if(poller->connections[fd]) {
+	if(fd <= poller->max_fd && poller->connections[fd]) {
 		return EALREADY;
 	}
 
+	err = grow(poller, fd);
+	if(err) {
+		return err;
+	}
+
 	poller->connections[fd] = atom;
 	install(poller, fd, flags);
 	if(fd > poller->max_fd) {
@@ -100,10 +174,10 @@ int io_select_set(io_select_poller *poller, io_atom *atom, int flags)
 {
 	int fd = atom->fd;
 
-	if(fd < 0 || fd >= FD_SETSIZE) {
+	if(fd < 0) {
 		return ERANGE;
 	}
-	if(!poller->connections[fd]) {
+	if(fd > poller->max_fd || !poller->connections[fd]) {
 		return EEXIST;
 	}
 
@@ -117,10 +191,10 @@ int io_select_remove(io_select_poller *poller, io_atom *atom)
 {
 	int fd = atom->fd;
 
-	if(fd < 0 || fd >= FD_SETSIZE) {
+	if(fd < 0) {
 		return ERANGE;
 	}
-	if(!poller->connections[fd]) {
+	if(fd > poller->max_fd || !poller->connections[fd]) {
 		return EALREADY;
 	}
 
@@ -130,8 +204,8 @@ int io_select_remove(io_select_poller *poller, io_atom *atom)
     // This io_delete is probably during an io_process.  Therefore,
     // we need to make sure that we don't later report an event
     // on a deleted io_atom.
-    FD_CLR(fd, &poller->gfd_read);
-    FD_CLR(fd, &poller->gfd_write);
+    BIT_CLR(poller->gfd_read, fd);
+    BIT_CLR(poller->gfd_write, fd);
 
 	while((poller->max_fd >= 0) && (poller->connections[poller->max_fd] == NULL))  {
 		poller->max_fd -= 1;
@@ -156,6 +230,7 @@ int io_select_wait(io_select_poller *poller, unsigned int timeout)
 {
 	struct timeval tv;
 	struct timeval *tvp = &tv;
+	size_t len;
 
 	if(timeout == INT_MAX) {
 		tvp = NULL;
@@ -164,10 +239,15 @@ int io_select_wait(io_select_poller *poller, unsigned int timeout)
 		tv.tv_usec = (timeout % 1000) * 1000;
 	}
 
-	poller->gfd_read = poller->fd_read;
-	poller->gfd_write = poller->fd_write;
+	// only copy as much of the sets as select will look at.
+	if(poller->max_fd >= 0) {
+		len = (WORD(poller->max_fd) + 1) * sizeof(io_select_word);
+		memcpy(poller->gfd_read, poller->fd_read, len);
+		memcpy(poller->gfd_write, poller->fd_write, len);
+	}
 
-	poller->cnt_fd = select(1+poller->max_fd, &poller->gfd_read, &poller->gfd_write, NULL, tvp);
+	poller->cnt_fd = select(1+poller->max_fd, (fd_set*)poller->gfd_read,
+			(fd_set*)poller->gfd_write, NULL, tvp);
     if(poller->cnt_fd < 0) {
         // it's not an error if we were interrupted.
         if(errno == EINTR) {
@@ -181,32 +261,42 @@ int io_select_wait(io_select_poller *poller, unsigned int timeout)
 
 int io_select_dispatch(struct io_poller *base_poller)
 {
-	int i, max;
+	int w, max, fd;
+	io_select_word bits;
 	io_atom *atom;
-	io_select_poller *poller = &base_poller->poller_data.select;
+	io_select_poller *poller = base_poller->poller_data.select;
 
     // Note that max_fd might change in the middle of this loop.
     // For instance, if an acceptor proc opens a new connection
     // and calls io_add, max_fd will take on the new value.  Therefore,
     // we need to loop on the value set at the start of the loop.
+    // That io_add may also reallocate the sets so don't hang onto them.
 
     if(poller->cnt_fd <= 0) {
     	return 0;
     }
 
-    max = poller->max_fd;
-    for(i=0; i <= max; i++) {
-    	atom = poller->connections[i];
-        if(FD_ISSET(i, &poller->gfd_read)) {
-        	(*atom->read_proc)(base_poller, atom);
-        }
-        if(FD_ISSET(i, &poller->gfd_write)) {
-        	(*atom->write_proc)(base_poller, atom);
-        }
-    }
+	// Scan a word at a time so we only visit fds that have events.
+	// A proc may remove an atom later in the set, which clears its
+	// bits, so each bit is checked again just before dispatching.
+	max = WORD(poller->max_fd);
+	for(w=0; w <= max; w++) {
+		bits = poller->gfd_read[w] | poller->gfd_write[w];
+		while(bits) {
+			fd = w*WORD_BITS + __builtin_ctzl(bits);
+			bits &= bits - 1;
+
+			atom = poller->connections[fd];
+			if(BIT_ISSET(poller->gfd_read, fd)) {
+				(*atom->read_proc)(base_poller, atom);
+			}
+			if(BIT_ISSET(poller->gfd_write, fd)) {
+				(*atom->write_proc)(base_poller, atom);
+			}
+		}
+	}
 
     return 0;
 }
 
 #endif
-
@@ -15,14 +15,18 @@
 #include "../atom.h"
 
 
-#ifndef FD_SETSIZE
-#define FD_SETSIZE 1024
-#endif
+// The bitmaps are allocated to fit the highest fd in use rather than
+// being fixed fd_sets, so the select poller isn't limited to FD_SETSIZE
+// descriptors.  Linux and the BSDs accept any size set as long as nfds
+// covers it.
+
+typedef unsigned long io_select_word;
+#define IO_SELECT_WORD_BITS (8*sizeof(io_select_word))
 
 
 struct io_select_poller {
-	io_atom* connections[FD_SETSIZE];
-	fd_set fd_read, fd_write;
+	io_atom** connections;	// indexed by fd.
+	io_select_word *fd_read, *fd_write;
 	
 	// Need to dispatch from a copy of the fd tables so that the
 	// io_procs can delete atoms w/o causing errors (picture deleting
@@ -30,8 +34,9 @@ struct io_select_poller {
 	// TODO: A much more elegant solution would be for io_delete to queue up delete
 	// requests if we're in the middle of dispatching and then handle
 	// them all in one go right before io_dispatch returns.
-	fd_set gfd_read, gfd_write;
-	
+	io_select_word *gfd_read, *gfd_write;
+
+	int num_words;	// the size of each bitmap.  connections holds num_words*IO_SELECT_WORD_BITS atoms.
 	int max_fd;	// the highest-numbered filedescriptor in connections.
 	int cnt_fd; // the number of fds that have events on them (set by io_select_wait()).
 };
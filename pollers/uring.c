@@ -0,0 +1,618 @@
+// uring.c
+// Scott Bronson
+// 17 Oct 2026
+//
+// Uses io_uring multishot poll to retrieve IO Atom events.
+//
+// Every io_add and io_set just queues a submission; nothing is handed
+// to the kernel until the next io_wait, which submits the whole batch
+// and collects completions in a single io_uring_enter.  Completions
+// are dispatched straight out of the shared completion ring so there's
+// no copying either.
+//
+// Each poll's user_data is the atom pointer with the IO_READ/IO_WRITE
+// flags stuffed into its low bits (atoms are always pointer-aligned).
+// That way a multishot poll that the kernel terminates can be re-armed
+// without us having to remember what the atom was interested in.
+//
+// Completion requests (io_submit_read/io_submit_write) are handed to the
+// kernel as plain reads and writes.  Their user_data is the io_request
+// pointer tagged with IO_URING_REQUEST.
+
+#include "../poller.h"
+
+#ifdef USE_URING
+
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+
+#define IO_URING_FLAG_MASK 0x03		// IO_READ|IO_WRITE
+#define IO_URING_REQUEST 0x04		// user_data is an io_request, not an atom
+#define IO_URING_TAG_MASK 0x07		// low bits that aren't part of the pointer
+
+#define ring_load(p)	__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define ring_store(p,v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags, void *arg, size_t argsz)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+
+// Hands all queued sqes to the kernel and, if flags contains
+// IORING_ENTER_GETEVENTS, waits for completions.
+
+static int enter(io_uring_poller *poller, unsigned int min_complete, unsigned int flags, void *arg, size_t argsz)
+{
+	int cnt;
+
+	do {
+		cnt = sys_io_uring_enter(poller->ringfd, poller->to_submit, min_complete, flags, arg, argsz);
+	} while(cnt < 0 && errno == EINTR && !(flags & IORING_ENTER_GETEVENTS));
+
+	if(cnt < 0) {
+		return errno ? errno : -1;
+	}
+
+	poller->to_submit -= (cnt < poller->to_submit ? cnt : poller->to_submit);
+	return 0;
+}
+
+
+// Returns a zeroed sqe ready to be filled in.  If the submission ring
+// is full, the pending sqes are flushed to the kernel first.
+
+static struct io_uring_sqe* get_sqe(io_uring_poller *poller)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int tail = *poller->sq_tail;
+
+	if(tail - ring_load(poller->sq_head) > poller->sq_mask) {
+		if(enter(poller, 0, 0, NULL, 0)) {
+			return NULL;
+		}
+		if(tail - ring_load(poller->sq_head) > poller->sq_mask) {
+			return NULL;
+		}
+	}
+
+	sqe = &poller->sqes[tail & poller->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+
+// Publishes the sqe returned by the most recent get_sqe.
+
+static void queue_sqe(io_uring_poller *poller)
+{
+	ring_store(poller->sq_tail, *poller->sq_tail + 1);
+	poller->to_submit += 1;
+}
+
+
+static int get_events(int flags)
+{
+	int events = 0;
+
+	if(flags & IO_READ) events |= POLLIN;
+	if(flags & IO_WRITE) events |= POLLOUT;
+
+	return events;
+}
+
+
+static int queue_poll(io_uring_poller *poller, io_atom *atom, int flags)
+{
+	struct io_uring_sqe *sqe;
+
+	if(!(flags & (IO_READ|IO_WRITE))) {
+		// nothing to watch for.
+		return 0;
+	}
+
+	sqe = get_sqe(poller);
+	if(!sqe) {
+		return EBUSY;
+	}
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = atom->fd;
+	sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->poll32_events = get_events(flags);
+	sqe->user_data = (uintptr_t)atom | (flags & IO_URING_FLAG_MASK);
+	queue_sqe(poller);
+
+	return 0;
+}
+
+
+// Cancels the atom's poll.  Only the poll is touched: completion
+// requests on the same fd (io_submit_read/io_submit_write) keep running.
+// We don't remember which flags the poll was armed with so each of the
+// possible user_datas gets a cancelation.  A cancelation only produces a
+// completion when it fails (i.e. there was nothing to cancel), and those
+// completions have a user_data of 0 so dispatch ignores them.
+
+static int queue_cancel(io_uring_poller *poller, io_atom *atom)
+{
+	struct io_uring_sqe *sqe;
+	int flags;
+
+	for(flags=IO_READ; flags<=(IO_READ|IO_WRITE); flags++) {
+		sqe = get_sqe(poller);
+		if(!sqe) {
+			return EBUSY;
+		}
+
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = (uintptr_t)atom | flags;
+		sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+		sqe->user_data = 0;
+		queue_sqe(poller);
+	}
+
+	return 0;
+}
+
+
+// Makes sure that no completion still sitting in the ring will be
+// dispatched to the given atom (or request).  Called after the atom's
+// polls have been canceled so no new completions can show up behind us.
+// Returns the number of completions that were removed.
+//
+// The atom's completions are squeezed out of the ring, not just zeroed,
+// so that completions the kernel had to hold back because the ring was
+// full (IORING_SQ_CQ_OVERFLOW) have somewhere to go.  Those are flushed
+// into the ring and scrubbed too; otherwise they'd show up after the
+// caller has freed the atom.
+
+static int scrub(io_uring_poller *poller, const void *ptr)
+{
+	struct io_uring_cqe *cqe;
+	unsigned int head, tail, keep;
+	int found = 0;
+
+	for(;;) {
+		head = *poller->cq_head;
+		tail = ring_load(poller->cq_tail);
+
+		// walk backward, packing the survivors against the tail.
+		keep = tail;
+		while(tail != head) {
+			tail--;
+			cqe = &poller->cqes[tail & poller->cq_mask];
+			if(!cqe->user_data) {
+				continue;
+			}
+			if((cqe->user_data & ~(__u64)IO_URING_TAG_MASK) == (uintptr_t)ptr) {
+				found += 1;
+				continue;
+			}
+			keep--;
+			if(keep != tail) {
+				poller->cqes[keep & poller->cq_mask] = *cqe;
+			}
+		}
+		ring_store(poller->cq_head, keep);
+
+		if(!(ring_load(poller->sq_flags) & IORING_SQ_CQ_OVERFLOW)) {
+			break;
+		}
+		// the ring is full of other atoms' completions.  they have to
+		// be dispatched before the overflow can be flushed.
+		if(keep == head && ring_load(poller->cq_tail) - head > poller->cq_mask) {
+			break;
+		}
+		tail = ring_load(poller->cq_tail);
+		if(enter(poller, 0, IORING_ENTER_GETEVENTS, NULL, 0) || ring_load(poller->cq_tail) == tail) {
+			break;
+		}
+	}
+
+	if(poller->dispatching == ptr) {
+		poller->dispatching = NULL;
+	}
+
+	return found;
+}
+
+
+static void unmap_rings(io_uring_poller *poller)
+{
+	if(poller->sqes && poller->sqes != MAP_FAILED) {
+		munmap(poller->sqes, poller->sqes_size);
+	}
+	if(poller->cq_ring && poller->cq_ring != MAP_FAILED && poller->cq_ring != poller->sq_ring) {
+		munmap(poller->cq_ring, poller->cq_ring_size);
+	}
+	if(poller->sq_ring && poller->sq_ring != MAP_FAILED) {
+		munmap(poller->sq_ring, poller->sq_ring_size);
+	}
+}
+
+
+int io_uring_init(io_uring_poller *poller)
+{
+	struct io_uring_params p;
+	unsigned int *array;
+	unsigned int i;
+	int err;
+
+	memset(poller, 0, sizeof(*poller));
+	memset(&p, 0, sizeof(p));
+
+	poller->ringfd = sys_io_uring_setup(IO_URING_ENTRIES, &p);
+	if(poller->ringfd < 0) {
+		return errno ? errno : -1;
+	}
+
+	// we need timeouts on io_uring_enter (5.11), we can't afford to
+	// have the kernel drop completions (5.5), and cancelations rely on
+	// IOSQE_CQE_SKIP_SUCCESS (5.17, which also has multishot polls).
+	// Older kernels get ENOSYS so io_poller_init falls back to epoll.
+	if(!(p.features & IORING_FEAT_EXT_ARG) || !(p.features & IORING_FEAT_NODROP) ||
+			!(p.features & IORING_FEAT_CQE_SKIP)) {
+		close(poller->ringfd);
+		return ENOSYS;
+	}
+
+	poller->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	poller->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if(p.features & IORING_FEAT_SINGLE_MMAP) {
+		if(poller->cq_ring_size > poller->sq_ring_size) {
+			poller->sq_ring_size = poller->cq_ring_size;
+		}
+		poller->cq_ring_size = poller->sq_ring_size;
+	}
+
+	poller->sq_ring = mmap(NULL, poller->sq_ring_size, PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_POPULATE, poller->ringfd, IORING_OFF_SQ_RING);
+	if(poller->sq_ring == MAP_FAILED) {
+		goto bail;
+	}
+
+	if(p.features & IORING_FEAT_SINGLE_MMAP) {
+		poller->cq_ring = poller->sq_ring;
+	} else {
+		poller->cq_ring = mmap(NULL, poller->cq_ring_size, PROT_READ|PROT_WRITE,
+				MAP_SHARED|MAP_POPULATE, poller->ringfd, IORING_OFF_CQ_RING);
+		if(poller->cq_ring == MAP_FAILED) {
+			goto bail;
+		}
+	}
+
+	poller->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	poller->sqes = mmap(NULL, poller->sqes_size, PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_POPULATE, poller->ringfd, IORING_OFF_SQES);
+	if(poller->sqes == MAP_FAILED) {
+		goto bail;
+	}
+
+	poller->sq_head = (unsigned int*)((char*)poller->sq_ring + p.sq_off.head);
+	poller->sq_tail = (unsigned int*)((char*)poller->sq_ring + p.sq_off.tail);
+	poller->sq_mask = *(unsigned int*)((char*)poller->sq_ring + p.sq_off.ring_mask);
+	poller->sq_flags = (unsigned int*)((char*)poller->sq_ring + p.sq_off.flags);
+
+	// sqe n always lives in slot n so the indirection array never changes.
+	array = (unsigned int*)((char*)poller->sq_ring + p.sq_off.array);
+	for(i=0; i<p.sq_entries; i++) {
+		array[i] = i;
+	}
+
+	poller->cq_head = (unsigned int*)((char*)poller->cq_ring + p.cq_off.head);
+	poller->cq_tail = (unsigned int*)((char*)poller->cq_ring + p.cq_off.tail);
+	poller->cq_mask = *(unsigned int*)((char*)poller->cq_ring + p.cq_off.ring_mask);
+	poller->cqes = (struct io_uring_cqe*)((char*)poller->cq_ring + p.cq_off.cqes);
+
+	return 0;
+
+bail:
+	err = errno ? errno : -1;
+	unmap_rings(poller);
+	close(poller->ringfd);
+	return err;
+}
+
+
+int io_uring_poller_dispose(io_uring_poller *poller)
+{
+	unmap_rings(poller);
+	if(close(poller->ringfd)) {
+		return errno ? errno : -1;
+	}
+	return 0;
+}
+
+
+int io_uring_fd_check(io_uring_poller *poller)
+{
+	// like epoll, io_uring can't tell us how many fds are being watched.
+	return 0;
+}
+
+
+/** Starts watching the atom.
+ *
+ * The poll is only queued here, it's submitted by the next io_wait.
+ * That means that errors like EBADF aren't reported by this call.
+ */
+
+int io_uring_add(io_uring_poller *poller, io_atom *atom, int flags)
+{
+	if(atom->fd < 0) {
+		return ERANGE;
+	}
+
+	return queue_poll(poller, atom, flags);
+}
+
+
+int io_uring_set(io_uring_poller *poller, io_atom *atom, int flags)
+{
+	int err;
+
+	if(atom->fd < 0) {
+		return ERANGE;
+	}
+
+	// Cancel-then-add is processed in order by the kernel, and the new
+	// poll reports any readiness that's already pending (just like
+	// EPOLL_CTL_MOD does).
+	err = queue_cancel(poller, atom);
+	if(err) {
+		return err;
+	}
+
+	return queue_poll(poller, atom, flags);
+}
+
+
+/** Stops watching the atom.
+ *
+ * Unlike add and set, this call goes to the kernel immediately.  The
+ * caller is probably about to close the fd or free the atom so we need
+ * to be sure that no completions will be delivered to it later.
+ */
+
+int io_uring_remove(io_uring_poller *poller, io_atom *atom)
+{
+	int err, err2;
+
+	if(atom->fd < 0) {
+		return ERANGE;
+	}
+
+	err = queue_cancel(poller, atom);
+	if(err) {
+		// the submission ring is jammed.  submit what made it in and
+		// try again.
+		enter(poller, 0, 0, NULL, 0);
+		err = queue_cancel(poller, atom);
+	}
+
+	// Even if the cancelation couldn't be queued, the atom must not be
+	// reachable from any completion we already know about.
+	err2 = enter(poller, 0, 0, NULL, 0);
+	scrub(poller, atom);
+
+	return err ? err : err2;
+}
+
+
+/** Submits all queued requests and waits for events.
+ *
+ * @param timeout The maximum amount of time we should wait in
+ * milliseconds.  INT_MAX is special-cased to mean forever.
+ *
+ * @returns the number of completions to be dispatched or a negative
+ * number if there was an error.  Signals and timeouts return 0.
+ */
+
+int io_uring_wait(io_uring_poller *poller, unsigned int timeout)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned int min_complete = 1;
+	int err;
+
+	memset(&arg, 0, sizeof(arg));
+	if(timeout < INT_MAX) {
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000L;
+		arg.ts = (uintptr_t)&ts;
+	}
+
+	// don't sleep if there are already completions waiting
+	if(ring_load(poller->cq_tail) != *poller->cq_head) {
+		min_complete = 0;
+	}
+
+	err = enter(poller, min_complete, IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+	if(err && err != EINTR && err != ETIME) {
+		poller->cnt_fd = -1;
+		return -1;
+	}
+
+	poller->wait_tail = ring_load(poller->cq_tail);
+	poller->cnt_fd = poller->wait_tail - *poller->cq_head;
+	return poller->cnt_fd;
+}
+
+
+static void complete_request(struct io_poller *base_poller, io_request *req, int res)
+{
+	io_stream *stream = req->stream;
+
+	if(req->is_write) {
+		stream->writing = NULL;
+	} else {
+		stream->reading = NULL;
+	}
+
+	if(res > 0) {
+		req->len = res;
+		req->err = 0;
+	} else {
+		req->len = 0;
+		// a 0-length read means the remote closed the connection,
+		// same as io_atom_read.
+		req->err = res < 0 ? -res : (req->is_write ? 0 : EPIPE);
+	}
+
+	(*req->proc)(base_poller, req);
+}
+
+
+int io_uring_dispatch(struct io_poller *base_poller)
+{
+	struct io_uring_cqe *cqe;
+	unsigned int head, cflags;
+	__u64 data;
+	int res, flags;
+	io_atom *atom;
+	io_uring_poller *poller = base_poller->poller_data.uring;
+
+	// scrub may move head past wait_tail when it squeezes completions
+	// out of the ring, so compare the signed distance instead of using !=.
+	while((int)(poller->wait_tail - (head = *poller->cq_head)) > 0) {
+		cqe = &poller->cqes[head & poller->cq_mask];
+		data = cqe->user_data;
+		res = cqe->res;
+		cflags = cqe->flags;
+
+		// Give the slot back before calling any procs.  If a proc
+		// removes an atom, scrub only needs to look at what's left.
+		head += 1;
+		ring_store(poller->cq_head, head);
+
+		if(data & IO_URING_REQUEST) {
+			complete_request(base_poller, (io_request*)(uintptr_t)(data & ~(__u64)IO_URING_TAG_MASK), res);
+			continue;
+		}
+
+		if(!data || res < 0) {
+			// scrubbed, failed cancelation, or canceled poll.
+			continue;
+		}
+
+		atom = (io_atom*)(uintptr_t)(data & ~(__u64)IO_URING_TAG_MASK);
+		flags = data & IO_URING_FLAG_MASK;
+
+		if(!(cflags & IORING_CQE_F_MORE)) {
+			// the kernel terminated the multishot poll.  re-arm it.
+			queue_poll(poller, atom, flags);
+		}
+
+		// any proc may remove (and free) the atom, which clears
+		// dispatching, so check it before every call.
+		poller->dispatching = atom;
+		if((res & POLLERR) && atom->error_proc) {
+			(*atom->error_proc)(base_poller, atom);
+			res &= ~POLLERR;
+		}
+		if((flags & IO_READ) && (res & (POLLIN|POLLERR|POLLHUP)) && poller->dispatching) {
+			(*atom->read_proc)(base_poller, atom);
+		}
+		if((flags & IO_WRITE) && (res & POLLOUT) && poller->dispatching) {
+			(*atom->write_proc)(base_poller, atom);
+		}
+		poller->dispatching = NULL;
+	}
+
+	return 0;
+}
+
+
+/** Queues a completion-style read or write.
+ *
+ * Like io_uring_add, it's handed to the kernel by the next io_wait.
+ */
+
+int io_uring_submit_request(struct io_poller *base_poller, io_request *req)
+{
+	io_uring_poller *poller = base_poller->poller_data.uring;
+	struct io_uring_sqe *sqe;
+
+	sqe = get_sqe(poller);
+	if(!sqe) {
+		return EBUSY;
+	}
+
+	sqe->opcode = req->is_write ? IORING_OP_WRITE : IORING_OP_READ;
+	sqe->fd = req->stream->io.fd;
+	sqe->off = (__u64)-1;		// use (and update) the file position, just like read(2)
+	sqe->addr = (uintptr_t)req->buf;
+	sqe->len = req->cnt;
+	sqe->user_data = (uintptr_t)req | IO_URING_REQUEST;
+	queue_sqe(poller);
+
+	return 0;
+}
+
+
+/** Cancels a request submitted by io_uring_submit_request.
+ *
+ * Doesn't return until the request's completion has arrived and been
+ * taken out of the ring, so its proc won't be called and the caller
+ * may free it.  The kernel finishes canceling a read or write on a
+ * socket or pipe right away; one that's already running in a kernel
+ * worker (a regular file) may take as long as the I/O does.
+ */
+
+int io_uring_cancel_request(struct io_poller *base_poller, io_request *req)
+{
+	io_uring_poller *poller = base_poller->poller_data.uring;
+	struct io_uring_sqe *sqe;
+	unsigned int waiting;
+	int err;
+
+	sqe = get_sqe(poller);
+	if(!sqe) {
+		return EBUSY;
+	}
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = (uintptr_t)req | IO_URING_REQUEST;
+	sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+	sqe->user_data = 0;
+	queue_sqe(poller);
+
+	err = enter(poller, 0, 0, NULL, 0);
+	if(err) {
+		return err;
+	}
+
+	while(!scrub(poller, req)) {
+		// wait for one more completion than the ring already holds.
+		waiting = ring_load(poller->cq_tail) - *poller->cq_head;
+		if(waiting > poller->cq_mask) {
+			// full of completions that need to be dispatched first.
+			return EBUSY;
+		}
+		err = enter(poller, waiting + 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		if(err && err != EINTR) {
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+#endif
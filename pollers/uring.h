@@ -0,0 +1,49 @@
+// uring.h
+// Scott Bronson
+// 17 Oct 2026
+
+// Data structures and prototypes used by the io_uring poller.
+
+#include <linux/io_uring.h>
+#include "../atom.h"
+#include "../stream.h"
+
+
+#ifndef IO_URING_ENTRIES
+#define IO_URING_ENTRIES 256
+#endif
+
+
+struct io_uring_poller {
+	int ringfd;
+	int cnt_fd;			// the number of cqes waiting to be dispatched (set by io_uring_wait()).
+	unsigned int wait_tail;	// the cq tail that io_uring_wait() saw.  dispatch stops here.
+	unsigned int to_submit;	// sqes that have been queued but not handed to the kernel yet.
+	io_atom *dispatching;	// the atom whose procs are being called.  cleared if it's removed.
+
+	unsigned int *sq_head, *sq_tail;
+	unsigned int sq_mask;
+	unsigned int *sq_flags;
+	struct io_uring_sqe *sqes;
+
+	unsigned int *cq_head, *cq_tail;
+	unsigned int cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size, sqes_size;
+};
+typedef struct io_uring_poller io_uring_poller;
+
+
+int io_uring_init(io_uring_poller *poller);
+int io_uring_poller_dispose(io_uring_poller *poller);
+int io_uring_fd_check(io_uring_poller *poller);
+int io_uring_add(io_uring_poller *poller, io_atom *atom, int flags);
+int io_uring_set(io_uring_poller *poller, io_atom *atom, int flags);
+int io_uring_remove(io_uring_poller *poller, io_atom *atom);
+int io_uring_wait(io_uring_poller *poller, unsigned int timeout);
+int io_uring_dispatch(struct io_poller *poller);
+int io_uring_submit_request(struct io_poller *poller, struct io_request *req);
+int io_uring_cancel_request(struct io_poller *poller, struct io_request *req);
+
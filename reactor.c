@@ -0,0 +1,217 @@
+/** @file reactor.c
+ *
+ * A pool of reactors, each running its own poller on its own thread.
+ *
+ * Work gets onto a reactor's thread through its poller's post queue
+ * (io_poller_post), so no locks are needed anywhere.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "reactor.h"
+
+
+static void stop_proc(io_poller *poller, void *arg)
+{
+	io_reactor_from_poller(poller)->running = 0;
+}
+
+
+static int reactor_init(io_reactor_pool *pool, io_reactor *reactor, int index, io_poller_type type)
+{
+	memset(reactor, 0, sizeof(*reactor));
+	reactor->pool = pool;
+	reactor->index = index;
+	reactor->cpu = -1;
+	reactor->listener.fd = -1;
+
+	return io_poller_init(&reactor->poller, type);
+}
+
+
+static void reactor_dispose(io_reactor *reactor)
+{
+	if(reactor->listener.fd >= 0) {
+		io_close(&reactor->poller, &reactor->listener);
+	}
+	io_poller_dispose(&reactor->poller);
+}
+
+
+int io_reactor_pool_init(io_reactor_pool *pool, io_reactor *reactors, int count, io_poller_type type)
+{
+	int i, err;
+
+	pool->reactors = reactors;
+	pool->count = 0;
+	pool->started = 0;
+
+	for(i=0; i<count; i++) {
+		err = reactor_init(pool, &reactors[i], i, type);
+		if(err) {
+			io_reactor_pool_dispose(pool);
+			return err;
+		}
+		pool->count = i + 1;
+	}
+
+	return 0;
+}
+
+
+int io_reactor_pool_listen(io_reactor_pool *pool, socket_addr local, io_proc accept_proc)
+{
+	io_reactor *reactor;
+	int i, err;
+
+	for(i=0; i<pool->count; i++) {
+		reactor = &pool->reactors[i];
+		err = io_listen(&reactor->poller, &reactor->listener, accept_proc, local,
+				IO_SOCKET_REUSEADDR | IO_SOCKET_REUSEPORT);
+		if(err) {
+			reactor->listener.fd = -1;
+			return err;
+		}
+
+		if(io_addr_port(&local) == 0) {
+			// the kernel picked a port.  the other reactors must use the same one.
+			socket_addr bound;
+			socklen_t len = sizeof(bound.u);
+			if(getsockname(reactor->listener.fd, &bound.u.sa, &len) == 0) {
+				io_addr_set_port(&local, io_addr_port(&bound));
+			}
+		}
+	}
+
+	return 0;
+}
+
+
+// Returns the nth cpu that we're allowed to run on, wrapping around.
+
+static int pick_cpu(int n)
+{
+	cpu_set_t allowed;
+	int cpu, cnt;
+
+	if(sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+		return -1;
+	}
+
+	cnt = CPU_COUNT(&allowed);
+	if(cnt <= 0) {
+		return -1;
+	}
+
+	n %= cnt;
+	for(cpu=0; cpu<CPU_SETSIZE; cpu++) {
+		if(CPU_ISSET(cpu, &allowed) && n-- == 0) {
+			return cpu;
+		}
+	}
+
+	return -1;
+}
+
+
+static void* reactor_thread(void *arg)
+{
+	io_reactor *reactor = arg;
+
+	while(reactor->running) {
+		if(io_wait(&reactor->poller, INT_MAX) < 0) {
+			continue;
+		}
+		io_dispatch(&reactor->poller);
+	}
+
+	return NULL;
+}
+
+
+int io_reactor_pool_start(io_reactor_pool *pool, int pin_cpus)
+{
+	io_reactor *reactor;
+	cpu_set_t set;
+	int i, err;
+
+	for(i=0; i<pool->count; i++) {
+		reactor = &pool->reactors[i];
+		reactor->running = 1;
+
+		err = pthread_create(&reactor->thread, NULL, reactor_thread, reactor);
+		if(err) {
+			reactor->running = 0;
+			io_reactor_pool_stop(pool);
+			return err;
+		}
+		pool->started = i + 1;
+
+		if(pin_cpus) {
+			reactor->cpu = pick_cpu(i);
+			if(reactor->cpu >= 0) {
+				CPU_ZERO(&set);
+				CPU_SET(reactor->cpu, &set);
+				if(pthread_setaffinity_np(reactor->thread, sizeof(set), &set)) {
+					reactor->cpu = -1;
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+
+int io_reactor_pool_broadcast(io_reactor_pool *pool, io_post_proc proc, void *arg)
+{
+	int i, err, result = 0;
+
+	for(i=0; i<pool->count; i++) {
+		err = io_poller_post(&pool->reactors[i].poller, proc, arg);
+		if(err && !result) {
+			result = err;
+		}
+	}
+
+	return result;
+}
+
+
+int io_reactor_pool_stop(io_reactor_pool *pool)
+{
+	int i;
+
+	for(i=0; i<pool->started; i++) {
+		io_post *node = &pool->reactors[i].stop;
+		io_poller_post_node(&pool->reactors[i].poller, node, stop_proc, NULL);
+	}
+
+	for(i=0; i<pool->started; i++) {
+		pthread_join(pool->reactors[i].thread, NULL);
+	}
+
+	pool->started = 0;
+	return 0;
+}
+
+
+int io_reactor_pool_dispose(io_reactor_pool *pool)
+{
+	int i;
+
+	for(i=0; i<pool->count; i++) {
+		reactor_dispose(&pool->reactors[i]);
+	}
+
+	pool->count = 0;
+	return 0;
+}
@@ -0,0 +1,112 @@
+/** @file reactor.h
+ *
+ * Runs a poller on each of several threads.
+ *
+ * Pollers aren't shared between threads, and neither are their atoms.
+ * Each reactor owns a poller and, if you ask for one, its own
+ * SO_REUSEPORT listening socket so the kernel spreads incoming
+ * connections across the reactors without any locking.
+ *
+ * Like everything else in IO Atom, you allocate the memory:
+ *
+ *		io_reactor_pool pool;
+ *		io_reactor reactors[4];
+ *
+ *		io_reactor_pool_init(&pool, reactors, 4, IO_POLLER_ANY);
+ *		io_reactor_pool_listen(&pool, local, accept_proc);
+ *		io_reactor_pool_start(&pool, 1);
+ *		...
+ *		io_reactor_pool_stop(&pool);
+ *		io_reactor_pool_dispose(&pool);
+ */
+
+#ifndef IO_REACTOR_H
+#define IO_REACTOR_H
+
+#include <pthread.h>
+#include "poller.h"
+
+
+struct io_reactor_pool;
+
+
+struct io_reactor {
+	io_poller poller;		///< the poller run by this reactor.  Only touch it from this reactor's thread.
+	struct io_reactor_pool *pool;
+	int index;				///< this reactor's position in the pool.
+	int cpu;				///< the cpu this reactor's thread is pinned to, or -1.
+	int running;			///< cleared to ask the thread to exit.
+	pthread_t thread;
+	io_post stop;			///< used to ask the thread to exit (so stopping can't fail).
+	io_atom listener;		///< this reactor's listening socket (fd is -1 if there isn't one).
+	void *data;				///< for your use.
+};
+typedef struct io_reactor io_reactor;
+
+
+struct io_reactor_pool {
+	io_reactor *reactors;
+	int count;
+	int started;
+};
+typedef struct io_reactor_pool io_reactor_pool;
+
+
+/** Returns the reactor that owns the given poller.  Handy in io_procs. */
+
+#define io_reactor_from_poller(p) io_resolve_parent((p), io_reactor, poller)
+
+
+/** Creates a poller for each reactor.
+ *
+ * @param reactors An array of count reactors.  It must stay put
+ *        until io_reactor_pool_dispose has been called.
+ * @param type The type of poller for each reactor to use.
+ */
+
+int io_reactor_pool_init(io_reactor_pool *pool, io_reactor *reactors, int count, io_poller_type type);
+
+
+/** Gives each reactor its own listening socket on the given address.
+ *
+ * Uses SO_REUSEPORT so the kernel load balances incoming connections.
+ * accept_proc is called on the thread of the reactor whose socket
+ * received the connection.  Call this before io_reactor_pool_start.
+ */
+
+int io_reactor_pool_listen(io_reactor_pool *pool, socket_addr local, io_proc accept_proc);
+
+
+/** Starts one thread per reactor.
+ *
+ * @param pin_cpus If nonzero, reactor n's thread is pinned to the nth
+ *        cpu that this process is allowed to run on (wrapping around
+ *        if there are more reactors than cpus).
+ */
+
+int io_reactor_pool_start(io_reactor_pool *pool, int pin_cpus);
+
+
+/** Calls proc(poller, arg) on every reactor's own thread.
+ *
+ * This returns as soon as the procs have been posted; it doesn't wait
+ * for them to run.  It may be called from any thread, including a
+ * reactor thread.  Use io_reactor_from_poller to find the reactor.
+ * To run something on a single reactor, use io_poller_post.
+ */
+
+int io_reactor_pool_broadcast(io_reactor_pool *pool, io_post_proc proc, void *arg);
+
+
+/** Asks every reactor thread to exit and waits until they have. */
+
+int io_reactor_pool_stop(io_reactor_pool *pool);
+
+
+/** Closes the listening sockets and disposes of the pollers.
+ *  The pool must be stopped first.
+ */
+
+int io_reactor_pool_dispose(io_reactor_pool *pool);
+
+#endif
@@ -0,0 +1,375 @@
+/** @file resolve.c
+ *
+ * Hostname lookups on a pool of resolver threads, with a TTL cache.
+ * See resolve.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netdb.h>
+
+#include "poller.h"
+#include "resolve.h"
+
+
+#define BUCKETS 256
+
+struct cache_entry {
+	struct cache_entry *next;
+	time_t expires;
+	socket_addr addr;
+	int err;
+	char host[IO_RESOLVE_MAX_HOST+1];
+};
+
+// everything below is protected by lock.
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+
+static io_resolve_req *queue_head, *queue_tail;
+static pthread_t threads[IO_RESOLVE_THREADS];
+static int nthreads;
+static int stopping;
+
+static struct cache_entry *cache[BUCKETS];
+static int cache_count;
+
+
+static time_t now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+
+// Hostnames are case insensitive.
+
+static unsigned hash(const char *host)
+{
+	unsigned h = 5381;
+	while(*host) {
+		h = h * 33 + tolower((unsigned char)*host++);
+	}
+	return h % BUCKETS;
+}
+
+
+// Returns host's cache entry, or NULL.  Frees expired entries on the
+// way.  Must hold lock.
+
+static struct cache_entry* cache_find(const char *host, time_t t)
+{
+	struct cache_entry **pp = &cache[hash(host)];
+	struct cache_entry *e;
+
+	while((e = *pp)) {
+		if(e->expires <= t) {
+			*pp = e->next;
+			free(e);
+			cache_count--;
+			continue;
+		}
+		if(strcasecmp(e->host, host) == 0) {
+			return e;
+		}
+		pp = &e->next;
+	}
+
+	return NULL;
+}
+
+
+// Remembers a lookup.  If the cache is full the answer just isn't
+// cached.  Must hold lock.
+
+static void cache_store(const char *host, const socket_addr *addr, int err)
+{
+	time_t t = now();
+	struct cache_entry *e;
+	unsigned h;
+
+	e = cache_find(host, t);
+	if(!e) {
+		if(cache_count >= IO_RESOLVE_CACHE_SIZE) {
+			return;
+		}
+		e = malloc(sizeof(*e));
+		if(!e) {
+			return;
+		}
+		strcpy(e->host, host);
+		h = hash(host);
+		e->next = cache[h];
+		cache[h] = e;
+		cache_count++;
+	}
+
+	e->addr = *addr;
+	e->err = err;
+	e->expires = t + (err ? IO_RESOLVE_NEGATIVE_TTL : IO_RESOLVE_TTL);
+}
+
+
+static void cache_clear(void)
+{
+	struct cache_entry *e;
+	int i;
+
+	for(i=0; i<BUCKETS; i++) {
+		while((e = cache[i])) {
+			cache[i] = e->next;
+			free(e);
+		}
+	}
+	cache_count = 0;
+}
+
+
+// Runs on the requesting poller's thread.
+
+static void deliver(io_poller *poller, void *arg)
+{
+	io_resolve_req *req = arg;
+	req->proc(poller, req);
+}
+
+
+static void post(io_resolve_req *req)
+{
+	io_poller_post_node(req->poller, &req->post, deliver, req);
+}
+
+
+// getaddrinfo sorts its answers by preference so the first one is used.
+
+static int lookup(const char *host, socket_addr *addr)
+{
+	struct addrinfo hints, *ai;
+	int err;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	err = getaddrinfo(host, NULL, &hints, &ai);
+	switch(err) {
+		case 0:
+			memset(addr, 0, sizeof(*addr));
+			memcpy(&addr->u, ai->ai_addr, ai->ai_addrlen);
+			freeaddrinfo(ai);
+			return 0;
+		case EAI_NONAME:
+#ifdef EAI_NODATA
+		case EAI_NODATA:
+#endif
+			return ENOENT;
+		case EAI_AGAIN:
+			return EAGAIN;
+		case EAI_MEMORY:
+			return ENOMEM;
+		case EAI_SYSTEM:
+			return errno ? errno : EIO;
+	}
+
+	return EIO;
+}
+
+
+static void* resolver(void *arg)
+{
+	io_resolve_req *req;
+
+	pthread_mutex_lock(&lock);
+	for(;;) {
+		while(!queue_head && !stopping) {
+			pthread_cond_wait(&wake, &lock);
+		}
+		if(stopping) {
+			break;
+		}
+
+		req = queue_head;
+		queue_head = req->next;
+		if(!queue_head) {
+			queue_tail = NULL;
+		}
+		pthread_mutex_unlock(&lock);
+
+		req->err = lookup(req->host, &req->addr);
+
+		pthread_mutex_lock(&lock);
+		// temporary failures aren't worth remembering.
+		if(req->err != EAGAIN) {
+			cache_store(req->host, &req->addr, req->err);
+		}
+		pthread_mutex_unlock(&lock);
+
+		io_addr_set_port(&req->addr, req->port);
+		post(req);
+		pthread_mutex_lock(&lock);
+	}
+	pthread_mutex_unlock(&lock);
+
+	return NULL;
+}
+
+
+// Converts an IPv4 or IPv6 address written as numbers.
+
+static int numeric(const char *host, socket_addr *addr)
+{
+	struct in_addr ip4;
+	struct in6_addr ip6;
+
+	if(inet_pton(AF_INET, host, &ip4) == 1) {
+		io_addr_ipv4(addr, ip4.s_addr, 0);
+		return 1;
+	}
+	if(inet_pton(AF_INET6, host, &ip6) == 1) {
+		io_addr_ipv6(addr, &ip6, 0);
+		return 1;
+	}
+	return 0;
+}
+
+
+// Starts the resolver threads with all signals blocked so they never
+// steal the application's signals.  Must hold lock.
+
+static int start_threads(void)
+{
+	sigset_t all, old;
+	int err = 0;
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	while(nthreads < IO_RESOLVE_THREADS) {
+		err = pthread_create(&threads[nthreads], NULL, resolver, NULL);
+		if(err) {
+			break;
+		}
+		nthreads++;
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	// one thread is enough to get by with.
+	return nthreads ? 0 : err;
+}
+
+
+int io_resolve_async(io_poller *poller, io_resolve_req *req, const char *host, io_resolve_proc proc)
+{
+	struct cache_entry *e;
+	int err;
+
+	if(strlen(host) > IO_RESOLVE_MAX_HOST) {
+		return ENAMETOOLONG;
+	}
+
+	strcpy(req->host, host);
+	req->proc = proc;
+	req->poller = poller;
+	req->next = NULL;
+
+	// numeric addresses don't need a lookup.
+	if(numeric(host, &req->addr)) {
+		io_addr_set_port(&req->addr, req->port);
+		req->err = 0;
+		req->cached = 1;
+		post(req);
+		return 0;
+	}
+
+	pthread_mutex_lock(&lock);
+	e = cache_find(host, now());
+	if(e) {
+		req->addr = e->addr;
+		io_addr_set_port(&req->addr, req->port);
+		req->err = e->err;
+		req->cached = 1;
+		pthread_mutex_unlock(&lock);
+		post(req);
+		return 0;
+	}
+
+	if(!nthreads) {
+		err = start_threads();
+		if(err) {
+			pthread_mutex_unlock(&lock);
+			return err;
+		}
+	}
+
+	req->cached = 0;
+	if(queue_tail) {
+		queue_tail->next = req;
+	} else {
+		queue_head = req;
+	}
+	queue_tail = req;
+	pthread_cond_signal(&wake);
+	pthread_mutex_unlock(&lock);
+
+	return 0;
+}
+
+
+int io_resolve_cached(const char *host, int port, socket_addr *addr)
+{
+	struct cache_entry *e;
+	int err = EAGAIN;
+
+	pthread_mutex_lock(&lock);
+	e = cache_find(host, now());
+	if(e) {
+		err = e->err;
+		if(!err) {
+			*addr = e->addr;
+			io_addr_set_port(addr, port);
+		}
+	}
+	pthread_mutex_unlock(&lock);
+
+	return err;
+}
+
+
+void io_resolve_shutdown(void)
+{
+	io_resolve_req *req;
+	int i, n;
+
+	pthread_mutex_lock(&lock);
+	stopping = 1;
+	req = queue_head;
+	queue_head = queue_tail = NULL;
+	n = nthreads;
+	pthread_cond_broadcast(&wake);
+	pthread_mutex_unlock(&lock);
+
+	while(req) {
+		io_resolve_req *next = req->next;
+		req->err = ECANCELED;
+		post(req);
+		req = next;
+	}
+
+	// lookups already underway finish and are delivered normally.
+	for(i=0; i<n; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	pthread_mutex_lock(&lock);
+	cache_clear();
+	nthreads = 0;
+	stopping = 0;
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,111 @@
+/** @file resolve.h
+ *
+ * Looks up hostnames without blocking the poller.
+ *
+ * io_resolve_async hands the lookup to a small pool of resolver
+ * threads that call getaddrinfo.  The answer comes back through the
+ * requesting poller's post queue, so your proc is called from
+ * io_dispatch on the poller's own thread like any other event.  Any
+ * number of pollers, on any number of threads, can share the resolver.
+ *
+ * Answers are cached for IO_RESOLVE_TTL seconds, failures for
+ * IO_RESOLVE_NEGATIVE_TTL.  getaddrinfo doesn't tell us the records'
+ * real TTLs so these are fixed.  Cached answers are still delivered
+ * through the post queue: the proc is never called from inside
+ * io_resolve_async.
+ *
+ *		static void resolved(io_poller *poller, io_resolve_req *req)
+ *		{
+ *			if(req->err) ...
+ *			io_connect(poller, ..., req->addr, IO_READ);
+ *		}
+ *		...
+ *		req->port = 80;
+ *		io_resolve_async(poller, req, "example.com", resolved);
+ */
+
+#ifndef IO_RESOLVE_H
+#define IO_RESOLVE_H
+
+#include "socket.h"
+
+
+/// The number of resolver threads, started when the first lookup is made.
+#ifndef IO_RESOLVE_THREADS
+#define IO_RESOLVE_THREADS 4
+#endif
+
+/// How long, in seconds, successful lookups are cached.
+#ifndef IO_RESOLVE_TTL
+#define IO_RESOLVE_TTL 60
+#endif
+
+/// How long, in seconds, failed lookups are cached.
+#ifndef IO_RESOLVE_NEGATIVE_TTL
+#define IO_RESOLVE_NEGATIVE_TTL 5
+#endif
+
+/// The most hostnames cached at once.
+#ifndef IO_RESOLVE_CACHE_SIZE
+#define IO_RESOLVE_CACHE_SIZE 1024
+#endif
+
+/// The longest hostname that can be looked up.
+#define IO_RESOLVE_MAX_HOST 255
+
+
+struct io_resolve_req;
+
+/** Called on the requesting poller's thread when the lookup is done. */
+
+typedef void (*io_resolve_proc)(struct io_poller *poller, struct io_resolve_req *req);
+
+
+/**
+ * A lookup.  Allocate it yourself (probably inside a larger structure)
+ * and keep it at the same address until its proc has been called.
+ */
+
+struct io_resolve_req {
+	io_resolve_proc proc;
+	struct io_poller *poller;
+	char host[IO_RESOLVE_MAX_HOST+1];
+	int port;						///< set this before calling io_resolve_async.
+	socket_addr addr;				///< on completion, the address (IPv4 or IPv6) with port filled in.
+	int err;						///< on completion, 0, ENOENT if there's no such host, EAGAIN for a temporary failure, or another error.
+	int cached;						///< on completion, set if the answer came from the cache.
+
+	struct io_resolve_req *next;	///< links requests waiting for a resolver thread.
+	io_post post;					///< used to hand the answer back to the poller.
+};
+typedef struct io_resolve_req io_resolve_req;
+
+
+/** Starts looking up host.
+ *
+ * @returns 0 if the lookup has started (proc will be called), or
+ *   ENAMETOOLONG or the error from starting the resolver threads
+ *   (proc won't be called).
+ */
+
+int io_resolve_async(struct io_poller *poller, io_resolve_req *req, const char *host, io_resolve_proc proc);
+
+
+/** Looks in the cache.
+ *
+ * @returns 0 and fills in addr (with port) if host has been looked up
+ *   recently, the cached error if the lookup failed, or EAGAIN if
+ *   host isn't in the cache.
+ */
+
+int io_resolve_cached(const char *host, int port, socket_addr *addr);
+
+
+/** Stops the resolver threads and empties the cache.  Lookups that
+ *  haven't been started are completed with ECANCELED.  Only call this
+ *  while your pollers are still running to receive them.
+ */
+
+void io_resolve_shutdown(void);
+
+#endif
@@ -0,0 +1,130 @@
+// selectbench.c
+//
+// Measures the cost of io_select_dispatch when only a few of many fds
+// are active.  It opens 1000 eventfds, signals 1% of them, and then
+// repeatedly dispatches the same select results, comparing the word-at-
+// a-time scan against the old FD_ISSET-per-fd loop.
+//
+//     make selectbench && ./selectbench [fds] [active] [iterations]
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/eventfd.h>
+
+#include "poller.h"
+
+
+static unsigned long events_handled;
+
+
+static void count_proc(io_poller *poller, io_atom *atom)
+{
+	events_handled += 1;
+}
+
+
+// The dispatch loop io_select_dispatch used to have.  FD_ISSET is
+// spelled out since fortified libcs abort on fds past FD_SETSIZE.
+
+#define ISSET(set,fd) ((set)[(fd) / IO_SELECT_WORD_BITS] & ((io_select_word)1 << ((fd) % IO_SELECT_WORD_BITS)))
+
+static void fd_isset_dispatch(io_poller *base_poller)
+{
+	io_select_poller *poller = base_poller->poller_data.select;
+	io_atom *atom;
+	int i, max;
+
+	max = poller->max_fd;
+	for(i=0; i <= max; i++) {
+		atom = poller->connections[i];
+		if(ISSET(poller->gfd_read, i)) {
+			(*atom->read_proc)(base_poller, atom);
+		}
+		if(ISSET(poller->gfd_write, i)) {
+			(*atom->write_proc)(base_poller, atom);
+		}
+	}
+}
+
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+int main(int argc, char **argv)
+{
+	io_poller poller;
+	io_atom *atoms;
+	int nfds = argc > 1 ? atoi(argv[1]) : 1000;
+	int active = argc > 2 ? atoi(argv[2]) : nfds / 100;
+	long iters = argc > 3 ? atol(argv[3]) : 200000;
+	uint64_t one = 1;
+	double start, old_ns, new_ns;
+	long i;
+	int err, fd;
+
+	err = io_poller_init(&poller, IO_POLLER_SELECT);
+	if(err) {
+		fprintf(stderr, "couldn't create select poller: %s\n", strerror(err));
+		exit(1);
+	}
+
+	atoms = calloc(nfds, sizeof(io_atom));
+	for(i=0; i<nfds; i++) {
+		fd = eventfd(0, EFD_NONBLOCK);
+		if(fd < 0) {
+			fprintf(stderr, "couldn't open fd %ld: %s\n", i, strerror(errno));
+			exit(1);
+		}
+		io_atom_init(&atoms[i], fd, count_proc, count_proc);
+		io_add(&poller, &atoms[i], IO_READ);
+	}
+
+	// spread the active fds evenly through the set
+	for(i=0; i<active; i++) {
+		if(write(atoms[i * nfds / active].fd, &one, sizeof(one)) < 0) {
+			perror("write");
+			exit(1);
+		}
+	}
+
+	if(io_wait(&poller, 0) != active) {
+		fprintf(stderr, "expected %d ready fds\n", active);
+		exit(1);
+	}
+
+	// select results stay in gfd_read so we can dispatch them over and over.
+	events_handled = 0;
+	start = now();
+	for(i=0; i<iters; i++) {
+		fd_isset_dispatch(&poller);
+	}
+	old_ns = (now() - start) * 1e9 / iters;
+
+	start = now();
+	for(i=0; i<iters; i++) {
+		(*poller.funcs->dispatch)(&poller);
+	}
+	new_ns = (now() - start) * 1e9 / iters;
+
+	printf("%d fds, %d active, %ld iterations, %lu events\n", nfds, active, iters, events_handled);
+	printf("FD_ISSET per fd:   %8.1f ns/dispatch\n", old_ns);
+	printf("word at a time:    %8.1f ns/dispatch\n", new_ns);
+	printf("speedup:           %8.1fx\n", old_ns / new_ns);
+
+	for(i=0; i<nfds; i++) {
+		io_close(&poller, &atoms[i]);
+	}
+	free(atoms);
+	io_poller_dispose(&poller);
+	return 0;
+}
@@ -9,6 +9,9 @@
  * errno numbers.
  */
 
+#define _GNU_SOURCE		// for recvmmsg and sendmmsg
+
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -16,11 +19,16 @@
 #include <errno.h>
 #include <values.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
+#include <sys/un.h>
+#include <stddef.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <stdint.h>
 
 #include "poller.h"
 
@@ -45,51 +53,246 @@ static int set_nonblock(int sd)
 }
 
 
-/** Connects to the given address.
+void io_addr_any(socket_addr *addr, int port)
+{
+	io_addr_ipv6(addr, &in6addr_any, port);
+}
+
+
+void io_addr_ipv4(socket_addr *addr, in_addr_t ip, int port)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->u.in4.sin_family = AF_INET;
+	addr->u.in4.sin_addr.s_addr = ip;
+	addr->u.in4.sin_port = htons(port);
+}
+
+
+void io_addr_ipv6(socket_addr *addr, const struct in6_addr *ip, int port)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->u.in6.sin6_family = AF_INET6;
+	addr->u.in6.sin6_addr = *ip;
+	addr->u.in6.sin6_port = htons(port);
+}
+
+
+int io_addr_unix(socket_addr *addr, const char *path)
+{
+	size_t len = strlen(path);
+
+	if(len >= sizeof(addr->u.un.sun_path)) {
+		return ENAMETOOLONG;
+	}
+
+	memset(addr, 0, sizeof(*addr));
+	addr->u.un.sun_family = AF_UNIX;
+	memcpy(addr->u.un.sun_path, path, len);
+#ifdef __linux__
+	if(path[0] == '@') {
+		addr->u.un.sun_path[0] = '\0';		// abstract namespace
+	}
+#endif
+
+	return 0;
+}
+
+
+int io_addr_port(const socket_addr *addr)
+{
+	switch(addr->u.sa.sa_family) {
+		case AF_INET:
+			return ntohs(addr->u.in4.sin_port);
+		case AF_INET6:
+			return ntohs(addr->u.in6.sin6_port);
+	}
+	return 0;
+}
+
+
+void io_addr_set_port(socket_addr *addr, int port)
+{
+	switch(addr->u.sa.sa_family) {
+		case AF_INET:
+			addr->u.in4.sin_port = htons(port);
+			break;
+		case AF_INET6:
+			addr->u.in6.sin6_port = htons(port);
+			break;
+		default:
+			io_addr_any(addr, port);
+	}
+}
+
+
+socklen_t io_addr_len(const socket_addr *addr)
+{
+	switch(addr->u.sa.sa_family) {
+		case AF_INET:
+			return sizeof(struct sockaddr_in);
+		case AF_INET6:
+			return sizeof(struct sockaddr_in6);
+		case AF_UNIX:
+			// an abstract name is only as long as its bytes, not to the first NUL.
+			if(addr->u.un.sun_path[0] == '\0') {
+				return offsetof(struct sockaddr_un, sun_path) + 1 +
+					strnlen(addr->u.un.sun_path + 1, sizeof(addr->u.un.sun_path) - 1);
+			}
+			return sizeof(struct sockaddr_un);
+	}
+	return sizeof(addr->u);
+}
+
+
+int io_addr_equal(const socket_addr *a, const socket_addr *b)
+{
+	if(a->u.sa.sa_family != b->u.sa.sa_family) {
+		return 0;
+	}
+
+	switch(a->u.sa.sa_family) {
+		case AF_INET:
+			return a->u.in4.sin_port == b->u.in4.sin_port &&
+				a->u.in4.sin_addr.s_addr == b->u.in4.sin_addr.s_addr;
+		case AF_INET6:
+			return a->u.in6.sin6_port == b->u.in6.sin6_port &&
+				a->u.in6.sin6_scope_id == b->u.in6.sin6_scope_id &&
+				IN6_ARE_ADDR_EQUAL(&a->u.in6.sin6_addr, &b->u.in6.sin6_addr);
+		case AF_UNIX:
+			return memcmp(a->u.un.sun_path, b->u.un.sun_path, sizeof(a->u.un.sun_path)) == 0;
+	}
+
+	return memcmp(a, b, sizeof(*a)) == 0;
+}
+
+
+char* io_addr_format(const socket_addr *addr, char *buf, size_t size)
+{
+	char ip[INET6_ADDRSTRLEN];
+
+	switch(addr->u.sa.sa_family) {
+		case AF_INET:
+			inet_ntop(AF_INET, &addr->u.in4.sin_addr, ip, sizeof(ip));
+			snprintf(buf, size, "%s:%d", ip, io_addr_port(addr));
+			break;
+		case AF_INET6:
+			inet_ntop(AF_INET6, &addr->u.in6.sin6_addr, ip, sizeof(ip));
+			snprintf(buf, size, "[%s]:%d", ip, io_addr_port(addr));
+			break;
+		case AF_UNIX:
+			if(addr->u.un.sun_path[0]) {
+				snprintf(buf, size, "%.*s", (int)sizeof(addr->u.un.sun_path), addr->u.un.sun_path);
+			} else if(addr->u.un.sun_path[1]) {
+				snprintf(buf, size, "@%.*s", (int)sizeof(addr->u.un.sun_path) - 1, addr->u.un.sun_path + 1);
+			} else {
+				snprintf(buf, size, "(unnamed)");
+			}
+			break;
+		default:
+			snprintf(buf, size, "(family %d)", addr->u.sa.sa_family);
+	}
+
+	return buf;
+}
+
+
+// Tidies an address the kernel just wrote len bytes of.  Whatever it
+// didn't write is cleared (an unnamed Unix socket is just a family).
+// A dual-stack socket reports IPv4 peers as ::ffff:a.b.c.d; those are
+// turned back into plain IPv4 addresses so they print and compare the
+// same as IPv4 addresses from anywhere else.
+
+static void received_addr(socket_addr *addr, socklen_t len)
+{
+	struct in_addr ip;
+	int port;
+
+	if(len < sizeof(addr->u)) {
+		memset((char*)&addr->u + len, 0, sizeof(addr->u) - len);
+	}
+
+	if(addr->u.sa.sa_family == AF_INET6 && IN6_IS_ADDR_V4MAPPED(&addr->u.in6.sin6_addr)) {
+		memcpy(&ip, &addr->u.in6.sin6_addr.s6_addr[12], sizeof(ip));
+		port = io_addr_port(addr);
+		io_addr_ipv4(addr, ip.s_addr, port);
+	}
+}
+
+
+// Opens a nonblocking socket of addr's family.  If this host has no
+// IPv6 and addr is the IPv6 wildcard, addr becomes the IPv4 wildcard
+// instead.  Unless IO_SOCKET_V6ONLY is set, IPv6 sockets accept IPv4
+// too.
+
+static int open_socket(socket_addr *addr, int type, int flags)
+{
+	int fd, opt;
+
+	fd = socket(addr->u.sa.sa_family, type, 0);
+	if(fd < 0 && errno == EAFNOSUPPORT && addr->u.sa.sa_family == AF_INET6 &&
+			IN6_IS_ADDR_UNSPECIFIED(&addr->u.in6.sin6_addr)) {
+		io_addr_ipv4(addr, htonl(INADDR_ANY), io_addr_port(addr));
+		fd = socket(AF_INET, type, 0);
+	}
+	if(fd < 0) {
+		return -1;
+	}
+
+	if(set_nonblock(fd) < 0) {
+		goto bail;
+	}
+
+	if(addr->u.sa.sa_family == AF_INET6) {
+		opt = (flags & IO_SOCKET_V6ONLY) != 0;
+		if(setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &opt, sizeof(opt)) < 0) {
+			goto bail;
+		}
+	}
+
+	return fd;
+
+bail:
+	opt = errno;
+	close(fd);
+	errno = opt;
+	return -1;
+}
+
+
+/** Starts connecting to the given address.  The socket is made
+ *  nonblocking first so this never waits for the remote.
  * 
  *  @param remote The address to connect to.
- *  @returns the new socket fd (>=0) or the error (<0) if unsuccessful.
+ *  @param pending Set if the connection is still being made.
+ *  @returns the new socket fd (>=0) or -1 with errno set if unsuccessful.
  */
 
-static int connect_fd(socket_addr remote)
+static int connect_fd(socket_addr remote, int *pending)
 {
-    struct sockaddr_in sa;
     int err;
 	int fd;
     
-    fd = socket(AF_INET, SOCK_STREAM, 0);
+    fd = open_socket(&remote, SOCK_STREAM, 0);
     if(fd < 0) {
 		return fd;
     }
 
-	memset(&sa, 0, sizeof(sa));
-	sa.sin_family = AF_INET;
-	sa.sin_addr.s_addr = htonl(INADDR_ANY);
-	sa.sin_port = htons(0);
-    
-	err = bind(fd, (struct sockaddr*)&sa, sizeof(sa));
-	if(err < 0) {
-		goto bail;
-	}
-
-    memset(&sa, 0, sizeof(sa));
-    sa.sin_family = AF_INET;
-    sa.sin_addr = remote.addr;
-    sa.sin_port = htons(remote.port);
-    
-    err = connect(fd, (struct sockaddr*)&sa, sizeof(sa));
+	*pending = 0;
+    err = connect(fd, &remote.u.sa, io_addr_len(&remote));
     if(err < 0) {
-		goto bail;
-    }
-    
-    if(set_nonblock(fd) < 0) {
-		goto bail;
+		// An interrupted connect carries on in the background too.
+		if(errno != EINPROGRESS && errno != EINTR) {
+			goto bail;
+		}
+		*pending = 1;
     }
 
 	return fd;
 
 bail:
+	err = errno;
 	close(fd);
+	errno = err;
 	return -1;
 }
 
@@ -104,31 +307,100 @@ bail:
  * 	(IO_READ will set it up initially to watch for read events,
  * 	IO_WRITE for write events).
  * 
- * @returns The new fd (>=0) if successful, or an error (<0) if not.
- * If there was an error, you should find the reason in strerror.
+ * @returns 0 if the connection was made right away, EINPROGRESS if
+ * it's still being made, or the error code if it failed.  If
+ * EINPROGRESS, the atom is added with only IO_WRITE and the write
+ * proc is called once the connection succeeds or fails.  Call
+ * io_socket_connect_finish from there to get the result and set flags.
  */
 
 int io_socket_connect(io_poller *poller, io_atom *io, io_proc read_proc, io_proc write_proc, socket_addr remote, int flags)
 {   
-	int err;
+	int err, pending;
 
-	io->fd = connect_fd(remote);
+	io->fd = connect_fd(remote, &pending);
 	if(io->fd < 0) {
-		return -1;
+		return errno ? errno : -1;
 	}
 
+	// while the connect is in progress we only want to hear when it's
+	// done.  io_socket_connect_finish sets the flags asked for.
 	io_atom_init(io, io->fd, read_proc, write_proc);
-	err = io_add(poller, io, flags);
-    if(err < 0) {
+	err = io_add(poller, io, pending ? IO_WRITE : flags);
+    if(err) {
 		goto bail;
     }
 
-    return io->fd;
+    return pending ? EINPROGRESS : 0;
 
 bail:
 	close(io->fd);
 	io->fd = -1;
-	return -1;
+	return err;
+}
+
+
+/** Finishes a connection that io_socket_connect left in progress.
+ *
+ * @param flags The flags the atom should have now that it's connected.
+ * @returns 0 if connected, otherwise why the connection failed
+ * (ECONNREFUSED, ETIMEDOUT, etc).  On failure the atom is left alone;
+ * you probably want to close it.
+ */
+
+int io_socket_connect_finish(io_poller *poller, io_atom *io, int flags)
+{
+	socklen_t len = sizeof(int);
+	int err = 0;
+
+	if(getsockopt(io->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) {
+		return errno ? errno : -1;
+	}
+	if(err) {
+		return err;
+	}
+
+	return io_set(poller, io, flags);
+}
+
+
+// Accepts a connection and makes it nonblocking and close-on-exec:
+// one system call with accept4, otherwise three or four.  Returns
+// the fd or -1 with errno set.
+
+static int accept_fd(int listener, socket_addr *remote)
+{
+	socklen_t plen = sizeof(remote->u);
+	int fd;
+
+	// the kernel writes the peer's address straight into remote.
+	do {
+#ifdef SOCK_NONBLOCK
+		fd = accept4(listener, remote ? &remote->u.sa : NULL, remote ? &plen : NULL,
+				SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+		fd = accept(listener, remote ? &remote->u.sa : NULL, remote ? &plen : NULL);
+#endif
+	} while(fd < 0 && errno == EINTR);
+
+	if(fd < 0) {
+		return -1;
+	}
+
+#ifndef SOCK_NONBLOCK
+	if(set_nonblock(fd) < 0 || fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) {
+		int err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+#endif
+
+	if(remote) {
+		received_addr(remote, plen);
+	}
+
+	return fd;
 }
 
 
@@ -144,113 +416,655 @@ bail:
  * you're using atoms to listen.
  *
  * @param io The socket that the incoming connection is arriving on.
- * @param remoteaddr If specified, store the address of the remote
- * computer initiating the connection here.  NULL means ignore.
- * @param remoteport If specified, store the port of the remote
+ * @param remote If specified, store the address and port of the remote
  * computer initiating the connection here.  NULL means ignore.
- * @returns the new socket descriptor if we succeeded or -1 if
- * there was an error.
+ * @returns 0 if we succeeded or the error code if not (EAGAIN when
+ * no more connections are waiting).  To accept them all at once, see
+ * io_socket_accept_all.
  */
 
 int io_socket_accept(io_poller *poller, io_atom *io, io_proc read_proc, io_proc write_proc, int flags, io_atom *listener, socket_addr *remote)
 {
-    struct sockaddr_in pin;
-    socklen_t plen = sizeof(pin);
 	int err;
 
-    while((io->fd = accept(listener->fd, (struct sockaddr*)&pin, &plen)) < 0) {
-        if(errno == EINTR) {
-            // This call was interrupted by a signal.  Try again and
-            // see if we receive a connection.
-            continue;
-        }
-        return errno ? errno : -1;
-    }
-
-    // Excellent.  We managed to connect to the remote socket.
-    if(set_nonblock(io->fd) < 0) {
-        close(io->fd);
-        return errno ? errno : -1;
-    }
+	io->fd = accept_fd(listener->fd, remote);
+	if(io->fd < 0) {
+		return errno ? errno : -1;
+	}
 
 	io_atom_init(io, io->fd, read_proc, write_proc);
     err = io_add(poller, io, flags);
-	if(err < 0) {
+	if(err) {
         close(io->fd);
+        io->fd = -1;
         return err;
     }
 
-    if(remote) {
-        remote->addr = pin.sin_addr;
-        remote->port = (int)ntohs(pin.sin_port);
-    }
-
     return 0;
 }
 
 
+int io_socket_accept_all(io_poller *poller, io_atom *listener, io_accept_proc proc, int *accepted)
+{
+	socket_addr remote;
+	int fd, cnt = 0, err = 0;
+
+	for(;;) {
+		fd = accept_fd(listener->fd, &remote);
+		if(fd < 0) {
+			// the peer gave up while waiting in the queue.  Next!
+			if(errno == ECONNABORTED || errno == EPROTO) {
+				continue;
+			}
+			if(errno != EAGAIN && errno != EWOULDBLOCK) {
+				err = errno ? errno : -1;
+			}
+			break;
+		}
+
+		cnt++;
+		proc(poller, listener, fd, &remote);
+	}
+
+	if(accepted) {
+		*accepted = cnt;
+	}
+	return err;
+}
+
+
+// A Unix socket's file outlives the process that made it.  If
+// connecting to it is refused, nobody is listening and it can be
+// removed.  Anything else -- a live listener, a full backlog, a file
+// that isn't a socket -- means the address really is in use.
+
+static int remove_stale_socket(const socket_addr *local)
+{
+	struct stat st;
+	int fd, err;
+
+	if(lstat(local->u.un.sun_path, &st) < 0) {
+		return 0;	// nothing there, or bind will say what's wrong.
+	}
+	if(!S_ISSOCK(st.st_mode)) {
+		return EADDRINUSE;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+	if(fd < 0) {
+		return errno ? errno : -1;
+	}
+	err = connect(fd, &local->u.sa, io_addr_len(local)) < 0 ? errno : 0;
+	close(fd);
+
+	if(err != ECONNREFUSED) {
+		return EADDRINUSE;
+	}
+	if(unlink(local->u.un.sun_path) < 0 && errno != ENOENT) {
+		return errno;
+	}
+	return 0;
+}
+
+
 /** Sets up a socket to listen on the given port.
  *
  * @param atom This should the uninitialized atom that will handle the events on
  * the socket. 
  *
- * @returns the new fd.
+ * @returns 0 if successful or the error code if not.
  */
 
-int io_socket_listen(io_poller *poller, io_atom *io, io_proc read_proc, socket_addr local, int reuse_addr)
+int io_socket_listen(io_poller *poller, io_atom *io, io_proc read_proc, socket_addr local, int flags)
 {
-    struct sockaddr_in sin;
-
-    if((io->fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-		return -1;
-    }
+    int err;
 
-    if(set_nonblock(io->fd) < 0) {
-        close(io->fd);
-		return -1;
+    if((io->fd = open_socket(&local, SOCK_STREAM, flags)) < 0) {
+		return errno ? errno : -1;
     }
 
     // for debugging when app is killed, remove when this isn't an issue.
-    if(reuse_addr) {
+    if(flags & IO_SOCKET_REUSEADDR) {
         int opt = 1;
         if(setsockopt(io->fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof (opt)) < 0) {
             close(io->fd);
-            return -1;
+            return errno ? errno : -1;
+        }
+    }
+
+    if((flags & IO_SOCKET_REUSEADDR) && local.u.sa.sa_family == AF_UNIX && local.u.un.sun_path[0]) {
+        err = remove_stale_socket(&local);
+        if(err) {
+            close(io->fd);
+            return err;
         }
     }
 
-    memset(&sin, 0, sizeof(sin));
-    sin.sin_family = AF_INET;
-    sin.sin_addr = local.addr;
-    sin.sin_port = htons(local.port);
+    // lets every reactor thread have its own listening socket.
+    if(flags & IO_SOCKET_REUSEPORT) {
+        int opt = 1;
+        if(setsockopt(io->fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof (opt)) < 0) {
+            close(io->fd);
+            return errno ? errno : -1;
+        }
+    }
 
-    if(bind(io->fd, (struct sockaddr*)&sin, sizeof(sin)) < 0) {
+    if(bind(io->fd, &local.u.sa, io_addr_len(&local)) < 0) {
         close(io->fd);
-		return -1;
+		return errno ? errno : -1;
     }
 
     // NOTE: if we're dropping connection requests under load, we
     // may need to tune the second parameter to listen.
     if (listen(io->fd, STD_LISTEN_SIZE) == -1) {
         close(io->fd);
-		return -1;
+		return errno ? errno : -1;
     }
 
     io_atom_init(io, io->fd, read_proc, NULL);
-    if(io_add(poller, io, IO_READ) < 0) {
+    err = io_add(poller, io, IO_READ);
+    if(err) {
         close(io->fd);
-		return -1;
+		return err;
     }
 
-	return io->fd;
+	return 0;
+}
+
+
+int io_socket_listen_unix(io_poller *poller, io_atom *io, io_proc accept_proc, const char *path, int flags)
+{
+	socket_addr local;
+	int err;
+
+	err = io_addr_unix(&local, path);
+	if(err) {
+		return err;
+	}
+
+	return io_socket_listen(poller, io, accept_proc, local, flags);
 }
 
 
+int io_socket_connect_unix(io_poller *poller, io_atom *io, io_proc read_proc, io_proc write_proc, const char *path, int flags)
+{
+	socket_addr remote;
+	int err;
+
+	err = io_addr_unix(&remote, path);
+	if(err) {
+		return err;
+	}
+
+	return io_socket_connect(poller, io, read_proc, write_proc, remote, flags);
+}
+
+
+int io_socketpair(int type, int fds[2])
+{
+#ifdef SOCK_NONBLOCK
+	if(socketpair(AF_UNIX, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) < 0) {
+		return errno ? errno : -1;
+	}
+#else
+	int err;
+
+	if(socketpair(AF_UNIX, type, 0, fds) < 0) {
+		return errno ? errno : -1;
+	}
+	if(set_nonblock(fds[0]) < 0 || set_nonblock(fds[1]) < 0 ||
+			fcntl(fds[0], F_SETFD, FD_CLOEXEC) < 0 || fcntl(fds[1], F_SETFD, FD_CLOEXEC) < 0) {
+		err = errno ? errno : -1;
+		close(fds[0]);
+		close(fds[1]);
+		return err;
+	}
+#endif
+
+	return 0;
+}
+
+
+// Room for an SCM_RIGHTS cmsg carrying IO_MAX_PASS_FDS descriptors.
+union fd_control {
+	char buf[CMSG_SPACE(sizeof(int) * IO_MAX_PASS_FDS)];
+	struct cmsghdr align;
+};
+
+
+int io_send_fds(io_poller *poller, io_atom *io, const char *buf, size_t cnt, size_t *wrlen, const int *fds, int nfds)
+{
+	union fd_control control;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cm;
+	ssize_t len;
+
+	*wrlen = 0;
+	if(cnt == 0 || nfds < 0 || nfds > IO_MAX_PASS_FDS) {
+		return EINVAL;
+	}
+
+	iov.iov_base = (char*)buf;
+	iov.iov_len = cnt;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if(nfds) {
+		msg.msg_control = control.buf;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+		cm = CMSG_FIRSTHDR(&msg);
+		cm->cmsg_level = SOL_SOCKET;
+		cm->cmsg_type = SCM_RIGHTS;
+		cm->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+		memcpy(CMSG_DATA(cm), fds, sizeof(int) * nfds);
+	}
+
+	do {
+		len = sendmsg(io->fd, &msg, MSG_NOSIGNAL);
+	} while(len < 0 && errno == EINTR);
+
+	if(len > 0) {
+		*wrlen = len;
+		return 0;
+	}
+
+	if(len < 0) {
+#if EAGAIN != EWOULDBLOCK
+		if(errno == EWOULDBLOCK) errno = EAGAIN;
+#endif
+		if(errno == ECONNRESET) errno = EPIPE;
+		return errno ? errno : -1;
+	}
+
+	return 0;
+}
+
+
+int io_recv_fds(io_poller *poller, io_atom *io, char *buf, size_t cnt, size_t *rdlen, int *fds, int *nfds)
+{
+	union fd_control control;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cm;
+	int room = *nfds, n, flags = 0;
+	ssize_t len;
+
+	*rdlen = 0;
+	*nfds = 0;
+	if(room > IO_MAX_PASS_FDS) {
+		room = IO_MAX_PASS_FDS;
+	}
+
+	iov.iov_base = buf;
+	iov.iov_len = cnt;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = CMSG_SPACE(sizeof(int) * room);
+
+#ifdef MSG_CMSG_CLOEXEC
+	flags |= MSG_CMSG_CLOEXEC;
+#endif
+	do {
+		len = recvmsg(io->fd, &msg, flags);
+	} while(len < 0 && errno == EINTR);
+
+	if(len < 0) {
+#if EAGAIN != EWOULDBLOCK
+		if(errno == EWOULDBLOCK) errno = EAGAIN;
+#endif
+		return errno ? errno : -1;
+	}
+
+	for(cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+		if(cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+			n = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			if(n > room - *nfds) {
+				n = room - *nfds;
+			}
+			memcpy(fds + *nfds, CMSG_DATA(cm), sizeof(int) * n);
+			*nfds += n;
+		}
+	}
+
+#ifndef MSG_CMSG_CLOEXEC
+	for(n=0; n<*nfds; n++) {
+		fcntl(fds[n], F_SETFD, FD_CLOEXEC);
+	}
+#endif
+
+	if(len == 0) {
+		// the remote has closed the connection.
+		return *nfds ? 0 : EPIPE;
+	}
+
+	*rdlen = len;
+	return 0;
+}
+
+
+// Creates a nonblocking UDP socket, applies the IO_SOCKET_* flags
+// and binds it to local.
+
+static int udp_socket(socket_addr local, int flags)
+{
+	int fd, opt = 1;
+
+	fd = open_socket(&local, SOCK_DGRAM, flags);
+	if(fd < 0) {
+		return -1;
+	}
+
+	if((flags & IO_SOCKET_REUSEADDR) && setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+		goto bail;
+	}
+	if((flags & IO_SOCKET_REUSEPORT) && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+		goto bail;
+	}
+
+	if(bind(fd, &local.u.sa, io_addr_len(&local)) < 0) {
+		goto bail;
+	}
+
+	return fd;
+
+bail:
+	opt = errno;
+	close(fd);
+	errno = opt;
+	return -1;
+}
+
+
+int io_socket_udp_bind(io_poller *poller, io_atom *io, io_proc read_proc, io_proc write_proc, socket_addr local, int flags)
+{
+	int err;
+
+	io->fd = udp_socket(local, flags);
+	if(io->fd < 0) {
+		return errno ? errno : -1;
+	}
+
+	io_atom_init(io, io->fd, read_proc, write_proc);
+	err = io_add(poller, io, IO_READ);
+	if(err) {
+		close(io->fd);
+		io->fd = -1;
+		return err;
+	}
+
+	return 0;
+}
+
+
+int io_socket_udp_connect(io_poller *poller, io_atom *io, io_proc read_proc, io_proc write_proc, socket_addr remote, int flags)
+{
+	int err;
+
+	io->fd = open_socket(&remote, SOCK_DGRAM, 0);
+	if(io->fd < 0) {
+		return errno ? errno : -1;
+	}
+
+	// a UDP connect just records the peer so it can't block.
+	if(connect(io->fd, &remote.u.sa, io_addr_len(&remote)) < 0) {
+		err = errno ? errno : -1;
+		goto bail;
+	}
+
+	io_atom_init(io, io->fd, read_proc, write_proc);
+	err = io_add(poller, io, flags);
+	if(err) {
+		goto bail;
+	}
+
+	return 0;
+
+bail:
+	close(io->fd);
+	io->fd = -1;
+	return err;
+}
+
+
+#ifdef __linux__
+
+// recvmmsg and sendmmsg need a header and an iovec for every datagram
+// in the batch, plus room for a GRO or GSO cmsg.  The addresses are
+// read and written in place in each io_datagram.
+struct batch {
+	struct mmsghdr msgs[IO_DATAGRAM_BATCH];
+	struct iovec iovs[IO_DATAGRAM_BATCH];
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control[IO_DATAGRAM_BATCH];
+};
+
+
+int io_socket_udp_gro(io_atom *io, int on)
+{
+	if(setsockopt(io->fd, SOL_UDP, UDP_GRO, &on, sizeof(on)) < 0) {
+		return errno ? errno : -1;
+	}
+	return 0;
+}
+
+
+// Returns the segment size from a GRO cmsg, or 0 if there isn't one.
+
+static size_t gro_segment(struct msghdr *msg)
+{
+	struct cmsghdr *cm;
+	int size;
+
+	for(cm = CMSG_FIRSTHDR(msg); cm; cm = CMSG_NXTHDR(msg, cm)) {
+		if(cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+			memcpy(&size, CMSG_DATA(cm), sizeof(size));
+			return size;
+		}
+	}
+	return 0;
+}
+
+
+// Attaches a UDP_SEGMENT cmsg asking the kernel to split the datagram.
+
+static void gso_segment(struct msghdr *msg, void *control, size_t segment)
+{
+	struct cmsghdr *cm;
+	uint16_t size = segment;
+
+	msg->msg_control = control;
+	msg->msg_controllen = CMSG_SPACE(sizeof(size));
+	cm = CMSG_FIRSTHDR(msg);
+	cm->cmsg_level = SOL_UDP;
+	cm->cmsg_type = UDP_SEGMENT;
+	cm->cmsg_len = CMSG_LEN(sizeof(size));
+	memcpy(CMSG_DATA(cm), &size, sizeof(size));
+}
+
+
+int io_recv_batch(io_poller *poller, io_atom *io, io_datagram *dgrams, int cnt, int *received)
+{
+	struct batch b;
+	int i, n, want, total = 0;
+
+	while(total < cnt) {
+		want = cnt - total < IO_DATAGRAM_BATCH ? cnt - total : IO_DATAGRAM_BATCH;
+		for(i=0; i<want; i++) {
+			b.iovs[i].iov_base = dgrams[total+i].buf;
+			b.iovs[i].iov_len = dgrams[total+i].size;
+			memset(&b.msgs[i].msg_hdr, 0, sizeof(b.msgs[i].msg_hdr));
+			b.msgs[i].msg_hdr.msg_iov = &b.iovs[i];
+			b.msgs[i].msg_hdr.msg_iovlen = 1;
+			b.msgs[i].msg_hdr.msg_name = &dgrams[total+i].addr.u;
+			b.msgs[i].msg_hdr.msg_namelen = sizeof(dgrams[total+i].addr.u);
+			b.msgs[i].msg_hdr.msg_control = b.control[i].buf;
+			b.msgs[i].msg_hdr.msg_controllen = sizeof(b.control[i].buf);
+		}
+
+		do {
+			n = recvmmsg(io->fd, b.msgs, want, 0, NULL);
+		} while(n < 0 && errno == EINTR);
+
+		if(n < 0) {
+			if(total) {
+				break;	// report the error next time.
+			}
+			*received = 0;
+			return errno ? errno : -1;
+		}
+
+		for(i=0; i<n; i++) {
+			dgrams[total+i].len = b.msgs[i].msg_len;
+			dgrams[total+i].truncated = (b.msgs[i].msg_hdr.msg_flags & MSG_TRUNC) != 0;
+			dgrams[total+i].segment = gro_segment(&b.msgs[i].msg_hdr);
+			received_addr(&dgrams[total+i].addr, b.msgs[i].msg_hdr.msg_namelen);
+		}
+		total += n;
+
+		if(n < want) {
+			break;		// the socket is empty.
+		}
+	}
+
+	*received = total;
+	return 0;
+}
+
+
+int io_send_batch(io_poller *poller, io_atom *io, io_datagram *dgrams, int cnt, int *sent)
+{
+	struct batch b;
+	int i, n, want, total = 0;
+
+	while(total < cnt) {
+		want = cnt - total < IO_DATAGRAM_BATCH ? cnt - total : IO_DATAGRAM_BATCH;
+		for(i=0; i<want; i++) {
+			b.iovs[i].iov_base = dgrams[total+i].buf;
+			b.iovs[i].iov_len = dgrams[total+i].len;
+			memset(&b.msgs[i].msg_hdr, 0, sizeof(b.msgs[i].msg_hdr));
+			b.msgs[i].msg_hdr.msg_iov = &b.iovs[i];
+			b.msgs[i].msg_hdr.msg_iovlen = 1;
+			if(io_addr_port(&dgrams[total+i].addr)) {
+				b.msgs[i].msg_hdr.msg_name = &dgrams[total+i].addr.u;
+				b.msgs[i].msg_hdr.msg_namelen = io_addr_len(&dgrams[total+i].addr);
+			}
+			if(dgrams[total+i].segment) {
+				gso_segment(&b.msgs[i].msg_hdr, b.control[i].buf, dgrams[total+i].segment);
+			}
+		}
+
+		do {
+			n = sendmmsg(io->fd, b.msgs, want, 0);
+		} while(n < 0 && errno == EINTR);
+
+		if(n < 0) {
+			if(total) {
+				break;
+			}
+			*sent = 0;
+			return errno ? errno : -1;
+		}
+
+		total += n;
+		if(n < want) {
+			break;		// the socket's buffer is full.
+		}
+	}
+
+	*sent = total;
+	return 0;
+}
+
+#else
+
+// No recvmmsg or sendmmsg here so it's one system call per datagram.
+
+int io_socket_udp_gro(io_atom *io, int on)
+{
+	return ENOPROTOOPT;
+}
+
+
+int io_recv_batch(io_poller *poller, io_atom *io, io_datagram *dgrams, int cnt, int *received)
+{
+	socklen_t slen;
+	ssize_t len;
+	int i;
+
+	for(i=0; i<cnt; i++) {
+		slen = sizeof(dgrams[i].addr.u);
+		do {
+			len = recvfrom(io->fd, dgrams[i].buf, dgrams[i].size, MSG_TRUNC, &dgrams[i].addr.u.sa, &slen);
+		} while(len < 0 && errno == EINTR);
+
+		if(len < 0) {
+			if(i) {
+				break;
+			}
+			*received = 0;
+			return errno ? errno : -1;
+		}
+
+		dgrams[i].truncated = (size_t)len > dgrams[i].size;
+		dgrams[i].len = dgrams[i].truncated ? dgrams[i].size : len;
+		dgrams[i].segment = 0;
+		received_addr(&dgrams[i].addr, slen);
+	}
+
+	*received = i;
+	return 0;
+}
+
+
+int io_send_batch(io_poller *poller, io_atom *io, io_datagram *dgrams, int cnt, int *sent)
+{
+	ssize_t len;
+	int i;
+
+	for(i=0; i<cnt; i++) {
+		do {
+			if(dgrams[i].segment) {
+				// no segmentation offload here.
+				len = -1;
+				errno = EINVAL;
+			} else if(io_addr_port(&dgrams[i].addr)) {
+				len = sendto(io->fd, dgrams[i].buf, dgrams[i].len, 0, &dgrams[i].addr.u.sa, io_addr_len(&dgrams[i].addr));
+			} else {
+				len = send(io->fd, dgrams[i].buf, dgrams[i].len, 0);
+			}
+		} while(len < 0 && errno == EINTR);
+
+		if(len < 0) {
+			if(i) {
+				break;
+			}
+			*sent = 0;
+			return errno ? errno : -1;
+		}
+	}
+
+	*sent = i;
+	return 0;
+}
+
+#endif
+
+
 /** Parses a string to an address suitable for use with io_socket.
  *  Accepts "1.1.1.1:22", "1.1.1.1" (default port), and "22" (default
- *  address).  Also accepts "host:22" and "host".  If a hostname consists
+ *  address).  IPv6 addresses are written "[::1]:22", or "::1" with no
+ *  port.  "/path" or "@name" is a Unix domain socket.  Also accepts
+ *  "host:22" and "host".  If a hostname consists
  *  of all numbers (talk about archaic) the it will be interpreted as
- *  a port unless you specify it as "222:".  Uses gethostbyname.
+ *  a port unless you specify it as "222:".  Hostnames are looked up
+ *  with getaddrinfo, which blocks; use io_resolve_async (resolve.h)
+ *  to look them up from a running poller.
  *
  *  If the string doesn't specify either an address or a port then the
  *  original contents of the sock variable remain unchanged.
@@ -272,14 +1086,32 @@ int io_socket_listen(io_poller *poller, io_atom *io, io_proc read_proc, socket_a
 char* io_parse_address(const char *spec, socket_addr *sock)
 {
 	char buf[512];
-	const char *colon;
-	int i;
+	const char *colon, *end;
+	int i, port;
 
-	struct hostent *he;
+	struct addrinfo hints, *ai;
 
-	/* If it contains ':' then both an address and a port. */
-	colon = strchr(spec, ':');
-	if(colon) {
+	// "/path" or "@abstract" is a Unix domain socket.
+	if(spec[0] == '/' || spec[0] == '@') {
+		if(io_addr_unix(sock, spec)) {
+			return "Socket path is too long: \"%s\"\n";
+		}
+		return NULL;
+	}
+
+	if(spec[0] == '[') {
+		// "[v6addr]:port" or "[v6addr]"
+		end = strchr(spec, ']');
+		if(!end || (end[1] && end[1] != ':')) {
+			return "Unterminated IPv6 address: \"%s\"\n";
+		}
+		if(end - spec - 1 > sizeof(buf)-1) {
+			return "Address is too long: \"%s\"\n";
+		}
+		memcpy(buf, spec+1, end-spec-1);
+		buf[end-spec-1] = '\0';
+		spec = end[1] ? end+2 : NULL;
+	} else if((colon = strchr(spec, ':')) && !strchr(colon+1, ':')) {
 		// it's an address:port combination
 		if(colon - spec > sizeof(buf)-1) {
 			return "Address is too long: \"%s\"\n";
@@ -294,11 +1126,11 @@ char* io_parse_address(const char *spec, socket_addr *sock)
 	} else {
 		// if it parses as a number, it's a lone port and we're done.
 		if(io_safe_atoi(spec, &i)) {
-			sock->port = i;
+			io_addr_set_port(sock, i);
 			return NULL;
 		}
 
-		// it's a lone address
+		// it's a lone address (a bare IPv6 address has many colons)
 		if(strlen(spec) > sizeof(buf)-1) {
 			return "Address is too long: \"%s\"\n";
 		}
@@ -306,26 +1138,35 @@ char* io_parse_address(const char *spec, socket_addr *sock)
 		spec = NULL;
 	}
 
-	// address is in buf
+	// address is in buf.  Numeric addresses are converted without a lookup.
 	if(buf[0]) {
-		he = gethostbyname(buf);
-		if(he == NULL) {
-			if(h_errno == HOST_NOT_FOUND) {
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		i = getaddrinfo(buf, NULL, &hints, &ai);
+		if(i) {
+			if(i == EAI_NONAME) {
 				return "Host \"%s\" not found.\n";
 			}
-			if(h_errno == NO_ADDRESS || h_errno == NO_DATA) {
+#ifdef EAI_NODATA
+			if(i == EAI_NODATA) {
 				return "No address for host \"%s\".\n";
 			}
+#endif
 			return "Error resolving host \"%s\".\n";
 		}
-		sock->addr = *(struct in_addr*)(he->h_addr_list[0]);
+		port = io_addr_port(sock);
+		memset(sock, 0, sizeof(*sock));
+		memcpy(&sock->u, ai->ai_addr, ai->ai_addrlen);
+		io_addr_set_port(sock, port);
+		freeaddrinfo(ai);
 	}
 
 	// port is in spec.  Spec may be empty, in which case
 	// we need to be sure to not modify port.
 	if(spec && spec[0]) {
 		if(io_safe_atoi(spec, &i)) {
-			sock->port = i;
+			io_addr_set_port(sock, i);
 		} else {
 			return "Invalid port \"%s\" specified.\n";
 		}
@@ -1,25 +1,116 @@
 /** @file socket.h
  *
- * This layers some IPv4 socket functionality on top of
- * whatever poller you decide to use.
+ * This layers some IPv4, IPv6 and Unix domain socket functionality
+ * on top of whatever poller you decide to use.
  */
 
 #ifndef IO_SOCKET_H
 #define IO_SOCKET_H
 
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
 struct io_poller;
 
 
+/** An IPv4 or IPv6 address and port, or a Unix domain socket path.
+ *
+ * Fill it in with io_addr_any, io_addr_ipv4, io_addr_ipv6, io_addr_unix
+ * or io_parse_address rather than by hand.  It's big enough for any
+ * address the kernel can hand back so accept and recvmmsg write
+ * straight into it.
+ */
+
 struct socket_addr {
-	struct in_addr addr;	///< packed address in network order (use inet_ntoa), htonl(INADDR_ANY) to listen on all addresses, or htonl(INADDR_LOOPBACK) to specify the loopback device.
-	int port;				///< port number in host order (regular int)
+	union {
+		struct sockaddr sa;
+		struct sockaddr_in in4;
+		struct sockaddr_in6 in6;
+		struct sockaddr_un un;
+		struct sockaddr_storage storage;
+	} u;
 };
 typedef struct socket_addr socket_addr;
 
 
+/// Enough room for io_addr_format: "[ffff:...:255.255.255.255]:65535"
+/// or a Unix socket's path.
+#define IO_ADDRSTRLEN (sizeof(((struct sockaddr_un*)0)->sun_path) + 2)
+
+
+/// Flags for io_socket_listen.  For compatibility, IO_SOCKET_REUSEADDR is 1.
+#define IO_SOCKET_REUSEADDR 0x01	///< set SO_REUSEADDR
+#define IO_SOCKET_REUSEPORT 0x02	///< set SO_REUSEPORT so multiple sockets (threads) can share the address
+#define IO_SOCKET_V6ONLY    0x04	///< an IPv6 socket won't also accept IPv4 (IPV6_V6ONLY)
+
+
+/** Sets addr to the wildcard address ("::"), for listening on every
+ *  address, IPv4 and IPv6.  On a host without IPv6 the sockets fall
+ *  back to IPv4's INADDR_ANY.
+ */
+
+void io_addr_any(socket_addr *addr, int port);
+
+/** Sets an IPv4 address given in network order, i.e. htonl(INADDR_LOOPBACK). */
+void io_addr_ipv4(socket_addr *addr, in_addr_t ip, int port);
+
+/** Sets an IPv6 address, i.e. &in6addr_loopback. */
+void io_addr_ipv6(socket_addr *addr, const struct in6_addr *ip, int port);
+
+/** Sets a Unix domain socket path.  On Linux a path starting with '@'
+ *  names a socket in the abstract namespace, which never touches the
+ *  filesystem.
+ *
+ * @returns 0 or ENAMETOOLONG.
+ */
+int io_addr_unix(socket_addr *addr, const char *path);
+
+/** Returns the port in host order, or 0 if addr hasn't been set or is a Unix socket. */
+int io_addr_port(const socket_addr *addr);
+
+/** Changes the port.  If addr hasn't been set it becomes the wildcard address. */
+void io_addr_set_port(socket_addr *addr, int port);
+
+/** Returns the length of the sockaddr for the address's family. */
+socklen_t io_addr_len(const socket_addr *addr);
+
+/** Returns nonzero if a and b are the same family, address and port. */
+int io_addr_equal(const socket_addr *a, const socket_addr *b);
+
+/** Writes "1.2.3.4:80", "[::1]:80" or the socket's path into buf, which should be
+ *  IO_ADDRSTRLEN bytes, and returns buf.
+ */
+char* io_addr_format(const socket_addr *addr, char *buf, size_t size);
+
+
+/** One datagram for io_recv_batch or io_send_batch. */
+
+struct io_datagram {
+	char *buf;			///< where to receive the datagram, or the data to send.
+	size_t size;		///< receive: the size of buf.
+	size_t len;			///< receive: the datagram's length.  send: the number of bytes to send.
+	socket_addr addr;	///< receive: who sent it.  send: where to send it, or port 0 (or never set) to use the connected peer.
+	int truncated;		///< receive: set if the datagram was bigger than size and has been cut off.
+	size_t segment;		///< send: if nonzero, the kernel splits buf into datagrams this big (GSO).  receive: see io_socket_udp_gro.
+};
+typedef struct io_datagram io_datagram;
+
+
+/// The most datagrams handed to the kernel in one recvmmsg or sendmmsg.
+/// Bigger batches are split up.
+#ifndef IO_DATAGRAM_BATCH
+#define IO_DATAGRAM_BATCH 64
+#endif
+
+
+/// The most file descriptors io_send_fds and io_recv_fds pass at once.
+#ifndef IO_MAX_PASS_FDS
+#define IO_MAX_PASS_FDS 16
+#endif
+
+
 /// Tells how many incoming connections we can handle at once
 /// (this is just the backlog parameter to listen; it's hardly
 /// even relevant anymore on Linux).
@@ -28,12 +119,16 @@ typedef struct socket_addr socket_addr;
 #endif
 
 
-/** Sets up an outgoing connection
+/** Sets up an outgoing connection without blocking.
  *
  * @param io The io_atom to use.
  * @param proc The io_proc to give the atom.
  * @param remote the IP address and port number of the system to connect to.
  * @param flags The read/write flags that the atom should start with.
+ * @returns 0 if connected immediately, EINPROGRESS if the connection
+ *   is still being made (the usual case), or an error.  On EINPROGRESS
+ *   the atom is added with only IO_WRITE and its write proc is called
+ *   when the connection succeeds or fails; call io_socket_connect_finish.
  *
  * todo: I don't think we give the user a way to select the local socket?
  * do we?
@@ -42,6 +137,17 @@ typedef struct socket_addr socket_addr;
 int io_socket_connect(struct io_poller *poller, io_atom *io, io_proc read_proc, io_proc write_proc, socket_addr remote, int flags);
 
 
+/** Call from the write proc after io_socket_connect returned EINPROGRESS.
+ *
+ * @param flags the flags the atom should have once it's connected
+ *   (usually IO_READ).
+ * @returns 0 if the connection is up, or why it failed (the
+ *   socket's SO_ERROR: ECONNREFUSED, ETIMEDOUT, EHOSTUNREACH...).
+ */
+
+int io_socket_connect_finish(struct io_poller *poller, io_atom *io, int flags);
+
+
 /** Accepts an incoming connection.
  *
  * You must have previously set up a listening socket using io_socket_listen.
@@ -57,6 +163,37 @@ int io_socket_connect(struct io_poller *poller, io_atom *io, io_proc read_proc,
 int io_socket_accept(struct io_poller *poller, io_atom *io, io_proc read_proc, io_proc write_proc, int flags, io_atom *listener, socket_addr *remote);
 
 
+/** Called by io_socket_accept_all for each new connection.
+ *
+ * @param listener the listening atom, so you can find your own
+ *      structure with io_resolve_parent.
+ * @param fd the new connection, already nonblocking and close-on-exec.
+ *      It's yours: io_atom_init and io_add it, or close it.
+ * @param remote the peer's address.  Copy it if you want to keep it.
+ */
+
+typedef void (*io_accept_proc)(struct io_poller *poller, io_atom *listener, int fd, const socket_addr *remote);
+
+
+/** Accepts every connection waiting on listener, handing each to proc.
+ *
+ * Call it from the listener's read proc.  On Linux each connection
+ * costs a single accept4 system call, with the new socket made
+ * nonblocking and close-on-exec by the kernel.  Connections that were
+ * aborted before they could be accepted are skipped.
+ *
+ * Not simulated by the mock poller; use io_socket_accept there.
+ *
+ * @param accepted if not NULL, returns the number of connections accepted.
+ * @returns 0 once no more connections are waiting, or the error that
+ *   stopped it.  On EMFILE or ENFILE connections are still waiting but
+ *   an edge-triggered poller won't report the listener again until
+ *   another arrives, so retry later (from a timer, say).
+ */
+
+int io_socket_accept_all(struct io_poller *poller, io_atom *listener, io_accept_proc proc, int *accepted);
+
+
 /** Sets up a socket to listen for incoming connections.
  *
  * Connections are passed to the io_proc using IO_READ.
@@ -64,31 +201,164 @@ int io_socket_accept(struct io_poller *poller, io_atom *io, io_proc read_proc, i
  *
  * @param io The io_atom to initialize for the new connection.
  * @param proc The io_proc to initialize the atom with.
- * @param the local IP address and port to listen on.  Use INADDR_ANY
- * 		to get the
- * @param reuse_addr 1 if we can reuse this socket (so you can kill the program and re-run
- *      it immediately without having to wait for TIME_WAIT.  0 is a little more secure though.
+ * @param local the address and port to listen on.  io_addr_any gives
+ *      a dual-stack socket that accepts both IPv4 and IPv6 connections;
+ *      IPv4 peers are reported as plain IPv4 addresses.
+ * @param flags IO_SOCKET_REUSEADDR if we can reuse this socket (so you can kill the
+ *      program and re-run it immediately without having to wait for TIME_WAIT.  0 is
+ *      a little more secure though.  Add IO_SOCKET_REUSEPORT to let several sockets
+ *      listen on the same address; the kernel spreads incoming connections among them.
+ *      IO_SOCKET_V6ONLY keeps an IPv6 socket from accepting IPv4.  For a
+ *      Unix socket, IO_SOCKET_REUSEADDR removes a stale socket file first:
+ *      one that refuses connections.  If something is still listening
+ *      on it, or the file isn't a socket, it gives EADDRINUSE.
  */
 
-int io_socket_listen(struct io_poller *poller, io_atom *io, io_proc accept_proc, socket_addr local, int reuse_addr);
+int io_socket_listen(struct io_poller *poller, io_atom *io, io_proc accept_proc, socket_addr local, int flags);
 
 
-/** Parses a string to an address suitable for use with io_socket.
- *  Accepts "1.1.1.1:22", "1.1.1.1" (default port), and "22" (default
- *  address).  If either the address or port weren't specified, then
- *  this code leaves the original value unchanged.  You can either
- *  fill in defaults before passing sock to this routine, or you can
- *  use sock.addr.s_addr=INADDR_ANY and sock.port=0 for illegal NULL
- *  values.
+/** Listens on a Unix domain socket.  Connections are accepted with
+ *  io_socket_accept, just like TCP.
  *
- *  If the string doesn't specify either an address or a port then the
- *  original contents of the sock variable remain unchanged.
+ * @param path the socket's path, or "@name" for Linux's abstract namespace.
+ * @param flags IO_SOCKET_REUSEADDR removes a socket file left at path by
+ *      a previous run, once connecting to it is refused.  A socket that's
+ *      still being listened on, or a file that isn't a socket, is never
+ *      removed and gives EADDRINUSE, as does any old socket file without
+ *      IO_SOCKET_REUSEADDR.
+ */
+
+int io_socket_listen_unix(struct io_poller *poller, io_atom *io, io_proc accept_proc, const char *path, int flags);
+
+
+/** Connects to a Unix domain socket.  Returns like io_socket_connect,
+ *  though a local connect usually completes at once.  EAGAIN means the
+ *  listener's backlog is full.
+ */
+
+int io_socket_connect_unix(struct io_poller *poller, io_atom *io, io_proc read_proc, io_proc write_proc, const char *path, int flags);
+
+
+/** Creates a pair of connected, nonblocking, close-on-exec Unix domain
+ *  sockets.  Hand one to a child process and keep the other, or use
+ *  them to talk between threads.  Neither is added to a poller; call
+ *  io_atom_init and io_add on the ones you keep.
+ *
+ * @param type SOCK_STREAM, SOCK_DGRAM or SOCK_SEQPACKET.
+ * @returns 0 or the error.
+ */
+
+int io_socketpair(int type, int fds[2]);
+
+
+/** Sends data along with open file descriptors (SCM_RIGHTS) over a
+ *  Unix domain socket.  The receiver gets its own copies; you may
+ *  close yours once this returns.
+ *
+ * At least one byte of data must be sent.  The fds are sent with
+ * the first byte, so if *wrlen is 0 nothing was sent and you should
+ * try again from the write proc.  Returns like io_write.
+ *
+ * @param nfds up to IO_MAX_PASS_FDS.
+ */
+
+int io_send_fds(struct io_poller *poller, io_atom *io, const char *buf, size_t cnt, size_t *wrlen, const int *fds, int nfds);
+
+
+/** Receives data and any file descriptors sent with it by io_send_fds.
+ *  Returns like io_read.
+ *
+ * The new fds are close-on-exec.  They share file status flags with
+ * the sender's, so a socket that was nonblocking there still is.
+ * If more fds arrive than there's room for, the kernel closes the
+ * extras.
+ *
+ * @param fds where to store the received fds.
+ * @param nfds pass the size of fds (up to IO_MAX_PASS_FDS), returns
+ *      the number received.
+ */
+
+int io_recv_fds(struct io_poller *poller, io_atom *io, char *buf, size_t cnt, size_t *rdlen, int *fds, int *nfds);
+
+
+/** Opens a UDP socket bound to a local address.
+ *
+ * The atom is added with IO_READ.  Receive with io_recv_batch from
+ * the read proc, draining until it returns EAGAIN.  Datagrams aren't
+ * simulated by the mock poller.
+ *
+ * @param flags IO_SOCKET_REUSEADDR and/or IO_SOCKET_REUSEPORT (lets
+ *      several threads each bind their own socket to the same port and
+ *      have the kernel spread datagrams among them), and IO_SOCKET_V6ONLY.
+ */
+
+int io_socket_udp_bind(struct io_poller *poller, io_atom *io, io_proc read_proc, io_proc write_proc, socket_addr local, int flags);
+
+
+/** Opens a UDP socket connected to a remote address.
+ *
+ * Only datagrams from remote are received, and io_send_batch can leave
+ * each datagram's addr.port at 0.
+ *
+ * @param flags The read/write flags that the atom should start with.
+ */
+
+int io_socket_udp_connect(struct io_poller *poller, io_atom *io, io_proc read_proc, io_proc write_proc, socket_addr remote, int flags);
+
+
+/** Turns UDP generic receive offload on or off.
+ *
+ * With GRO on, the kernel may hand io_recv_batch several datagrams
+ * from the same sender glued together in one buf, all but the last
+ * exactly segment bytes long.  segment is 0 for a lone datagram.  Use
+ * big receive buffers (64K) or the coalesced datagrams are truncated.
+ *
+ * Sending with segment set (GSO, UDP_SEGMENT) needs no setup.  Both
+ * are Linux only (4.18 for GSO, 5.0 for GRO); elsewhere this returns
+ * ENOPROTOOPT and io_send_batch returns EINVAL for segmented sends.
+ */
+
+int io_socket_udp_gro(io_atom *io, int on);
+
+
+/** Receives up to cnt datagrams with as few system calls as possible
+ *  (one recvmmsg per IO_DATAGRAM_BATCH on Linux).
+ *
+ * Fill in each datagram's buf and size first.
+ *
+ * @param received returns the number of datagrams received.
+ * @returns 0 if any were received, EAGAIN if none were waiting, or an error.
+ */
+
+int io_recv_batch(struct io_poller *poller, io_atom *io, io_datagram *dgrams, int cnt, int *received);
+
+
+/** Sends up to cnt datagrams with as few system calls as possible.
+ *
+ * Set a datagram's segment to have the kernel split it into many
+ * datagrams of that size (the last may be shorter).  One buf can hold
+ * up to 64 segments and 64K in all.
+ *
+ * @param sent returns the number of datagrams sent.  If it's less than
+ *      cnt the socket's buffer is full; send the rest from the write proc.
+ * @returns 0 if any were sent, EAGAIN if none could be, or an error.
+ */
+
+int io_send_batch(struct io_poller *poller, io_atom *io, io_datagram *dgrams, int cnt, int *sent);
+
+
+/** Parses a string to an address suitable for use with io_socket.
+ *  Accepts "1.1.1.1:22", "[::1]:22", "1.1.1.1" or "::1" (default
+ *  port), "22" (default address), and hostnames in place of any
+ *  address.  "/path" or "@name" gives a Unix domain socket.  If either the address or port weren't specified, then
+ *  this code leaves the original value unchanged, so fill in defaults
+ *  with io_addr_any or friends before calling it.
  *
  *  @returns NULL if no error, or an error format string if an error was
  *  discovered.  To handle the error, use something like the following
  *  code:
  *
- *  	char *errstr = io_socket_parse(str, &sock);
+ *  	char *errstr = io_parse_address(str, &sock);
  *  	if(errstr) {
  *  		fprintf(stderr, errstr, str);
  *  		exit(1);
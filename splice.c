@@ -0,0 +1,155 @@
+/** @file splice.c
+ *
+ * Moves data between two atoms through a pipe with splice(2).
+ * See splice.h.
+ */
+
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "poller.h"
+#include "splice.h"
+
+
+#ifdef __linux__
+
+// Turns a flag on or off, calling io_set only if it changed.
+
+static int update_flag(io_poller *poller, io_atom *atom, int *flags, int flag, int on)
+{
+	int want = on ? (*flags | flag) : (*flags & ~flag);
+	int err;
+
+	if(want == *flags) {
+		return 0;
+	}
+
+	err = io_set(poller, atom, want);
+	if(!err) {
+		*flags = want;
+	}
+	return err;
+}
+
+
+int io_splice_init(io_splice *sp, int *src_flags, int *dst_flags)
+{
+	int size;
+
+	if(pipe2(sp->pipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+		return errno ? errno : -1;
+	}
+
+	// a bigger pipe means fewer trips through the event loop.
+	fcntl(sp->pipe[1], F_SETPIPE_SZ, IO_SPLICE_PIPE_SIZE);
+	size = fcntl(sp->pipe[1], F_GETPIPE_SZ);
+	sp->pipe_size = size > 0 ? size : 65536;
+
+	sp->buffered = 0;
+	sp->forwarded = 0;
+	sp->eof = 0;
+	sp->src_flags = src_flags;
+	sp->dst_flags = dst_flags;
+
+	return 0;
+}
+
+
+void io_splice_dispose(io_splice *sp)
+{
+	if(sp->pipe[0] >= 0) {
+		close(sp->pipe[0]);
+		close(sp->pipe[1]);
+	}
+	sp->pipe[0] = sp->pipe[1] = -1;
+	sp->buffered = 0;
+}
+
+
+int io_splice_forward(io_poller *poller, io_atom *src, io_atom *dst, io_splice *sp)
+{
+	unsigned int flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+	ssize_t len;
+	int progress, stalled = 0, err;
+
+	do {
+		progress = 0;
+
+		// fill the pipe from src.  The pipe holds a limited number of
+		// pages, not bytes, so it can be full while buffered is well
+		// under pipe_size.  EAGAIN only means src is empty if the pipe
+		// is; otherwise we drain into dst and try again.
+		if(!sp->eof && sp->buffered < sp->pipe_size) {
+			do {
+				len = splice(src->fd, NULL, sp->pipe[1], NULL,
+						sp->pipe_size - sp->buffered, flags);
+			} while(len < 0 && errno == EINTR);
+
+			if(len > 0) {
+				sp->buffered += len;
+				progress = 1;
+				stalled = 0;
+			} else if(len == 0) {
+				sp->eof = 1;
+			} else if(errno == EAGAIN) {
+				stalled = (sp->buffered > 0);
+			} else {
+				return errno;
+			}
+		}
+
+		// and drain it into dst.
+		if(sp->buffered) {
+			do {
+				len = splice(sp->pipe[0], NULL, dst->fd, NULL, sp->buffered, flags);
+			} while(len < 0 && errno == EINTR);
+
+			if(len > 0) {
+				sp->buffered -= len;
+				sp->forwarded += len;
+				progress = 1;
+			} else if(len < 0 && errno != EAGAIN) {
+				return errno;
+			}
+		}
+	} while(progress);
+
+	if(sp->eof && !sp->buffered) {
+		return EPIPE;
+	}
+
+	// Anything left in the pipe means dst is full.  Wait for it to
+	// drain, and stop reading from src if the pipe can't hold more
+	// (the data stays in src's socket buffer and TCP slows the sender).
+	// Otherwise a readable src would wake us over and over for nothing.
+	err = update_flag(poller, dst, sp->dst_flags, IO_WRITE, sp->buffered > 0);
+	if(!err) {
+		err = update_flag(poller, src, sp->src_flags, IO_READ,
+				!sp->eof && !stalled && sp->buffered < sp->pipe_size);
+	}
+	return err;
+}
+
+#else
+
+int io_splice_init(io_splice *sp, int *src_flags, int *dst_flags)
+{
+	sp->pipe[0] = sp->pipe[1] = -1;
+	return ENOSYS;
+}
+
+
+void io_splice_dispose(io_splice *sp)
+{
+}
+
+
+int io_splice_forward(struct io_poller *poller, io_atom *src, io_atom *dst, io_splice *sp)
+{
+	return ENOSYS;
+}
+
+#endif
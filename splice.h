@@ -0,0 +1,85 @@
+/** @file splice.h
+ *
+ * Forwards data from one atom to another without copying it through
+ * user space.
+ *
+ * An io_splice owns a kernel pipe.  io_splice_forward moves whatever
+ * src has into the pipe and from the pipe out to dst using splice(2),
+ * so a relay never touches the bytes it forwards.  Linux only; on
+ * other systems io_splice_init returns ENOSYS and you should fall
+ * back to io_read and io_write (or io_bufpool and io_outq).
+ *
+ * Call io_splice_forward from src's read proc and from dst's write
+ * proc.  When dst can't take any more and the pipe is full, the
+ * splice stops reading from src (clearing IO_READ) and waits for dst
+ * to become writable (setting IO_WRITE).  To do that without upsetting
+ * the atoms' other flags it needs to know what they are, so you keep
+ * an int holding each atom's current flags and hand the splice
+ * pointers to them.  In a two-way relay each connection's flags word
+ * is shared by both splices: one manages its IO_READ, the other its
+ * IO_WRITE.
+ *
+ *		io_splice_init(&relay->up, &relay->client_flags, &relay->server_flags);
+ *		io_splice_init(&relay->down, &relay->server_flags, &relay->client_flags);
+ *		...
+ *		// client's read proc and server's write proc
+ *		err = io_splice_forward(poller, &relay->client, &relay->server, &relay->up);
+ */
+
+#ifndef IO_SPLICE_H
+#define IO_SPLICE_H
+
+#include <stddef.h>
+#include "atom.h"
+
+
+/// The pipe size to ask for.  The kernel may round it or refuse it,
+/// in which case you get the default (usually 64K).
+#ifndef IO_SPLICE_PIPE_SIZE
+#define IO_SPLICE_PIPE_SIZE (256*1024)
+#endif
+
+
+struct io_splice {
+	int pipe[2];			///< the read and write ends of the pipe.
+	size_t pipe_size;		///< how much the pipe can hold.
+	size_t buffered;		///< the number of bytes sitting in the pipe.
+	size_t forwarded;		///< the total number of bytes written to dst.
+	int eof;				///< set once src has been closed by the remote.
+	int *src_flags;			///< src's current flags.  We manage IO_READ.
+	int *dst_flags;			///< dst's current flags.  We manage IO_WRITE.
+};
+typedef struct io_splice io_splice;
+
+
+/** Creates the splice's pipe.
+ *
+ * @param src_flags points to the flags src was added to the poller with.
+ * @param dst_flags points to the flags dst was added to the poller with.
+ * @returns 0, ENOSYS if splice isn't available, or the error from pipe().
+ */
+
+int io_splice_init(io_splice *sp, int *src_flags, int *dst_flags);
+
+
+/** Closes the splice's pipe, discarding anything still in it.
+ *  This doesn't touch either atom.
+ */
+
+void io_splice_dispose(io_splice *sp);
+
+
+/** Moves as much data from src to dst as both will allow.
+ *
+ * Call this from src's read proc and dst's write proc.  It splices
+ * until src runs dry or dst is full, then sets the atoms' flags so
+ * that you'll be called again when there's more to do.
+ *
+ * @returns 0 if it would block, EPIPE once src has been closed and
+ * everything it sent has been forwarded, or the error from splice
+ * (EPIPE or ECONNRESET from dst means the other end has gone away).
+ */
+
+int io_splice_forward(struct io_poller *poller, io_atom *src, io_atom *dst, io_splice *sp);
+
+#endif
@@ -0,0 +1,262 @@
+// splicebench.c
+//
+// Relays a stream of data between two loopback TCP connections and
+// reports the throughput.  A producer thread writes into one end, a
+// consumer thread reads from the other, and the poller in between
+// forwards everything either with io_splice_forward or by reading into
+// pooled buffers and queueing them on an io_outq (one copy in and one
+// copy out of user space).
+//
+// On loopback the producer and consumer do most of the copying so the
+// wall clock barely moves.  Watch the relay's CPU time instead; that's
+// what a proxy pays per forwarded byte.
+//
+//     make splicebench
+//     ./splicebench splice
+//     ./splicebench copy
+//
+// usage: splicebench [splice|copy] [megabytes]
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "poller.h"
+#include "outq.h"
+#include "bufpool.h"
+#include "splice.h"
+
+
+#define CHUNK (64*1024)
+#define BUF_SIZE (64*1024)
+#define HIGH_WATER (512*1024)
+#define LOW_WATER (128*1024)
+
+// the relay's two sockets: data arrives on in and leaves on out.
+static io_atom in, out;
+static int in_flags, out_flags;
+static io_splice sp;
+static io_outq in_q, out_q;
+static io_bufpool pool;
+static int done;
+
+static long long total;
+
+
+static void finish(io_poller *poller, int err)
+{
+	if(err != EPIPE) {
+		fprintf(stderr, "relay: %s\n", strerror(err));
+	}
+	done = 1;
+}
+
+
+static void splice_proc(io_poller *poller, io_atom *atom)
+{
+	int err = io_splice_forward(poller, &in, &out, &sp);
+	if(err) {
+		finish(poller, err);
+	}
+}
+
+
+static void copy_read_proc(io_poller *poller, io_atom *atom)
+{
+	io_buf *buf;
+	int err;
+
+	while(!in_q.paused) {
+		buf = io_buf_alloc(&pool);
+		if(!buf) {
+			finish(poller, ENOMEM);
+			return;
+		}
+		err = io_buf_read(poller, &in, buf);
+		if(!err) {
+			err = io_buf_queue(poller, &out_q, buf);
+		}
+		io_buf_unref(buf);
+		if(err) {
+			if(err != EAGAIN) {
+				finish(poller, err);
+			}
+			return;
+		}
+	}
+}
+
+
+static void copy_write_proc(io_poller *poller, io_atom *atom)
+{
+	int err = io_outq_flush(poller, &out_q);
+	if(err) {
+		finish(poller, err);
+	}
+}
+
+
+static void* producer(void *arg)
+{
+	int fd = *(int*)arg;
+	char *buf = malloc(CHUNK);
+	long long left = total;
+	ssize_t len;
+
+	memset(buf, 'x', CHUNK);
+	while(left > 0) {
+		len = write(fd, buf, left < CHUNK ? left : CHUNK);
+		if(len < 0) {
+			perror("producer");
+			break;
+		}
+		left -= len;
+	}
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+
+static void* consumer(void *arg)
+{
+	int fd = *(int*)arg;
+	char *buf = malloc(CHUNK);
+	long long got = 0;
+	ssize_t len;
+
+	while((len = read(fd, buf, CHUNK)) > 0) {
+		got += len;
+	}
+	if(got != total) {
+		fprintf(stderr, "consumer got %lld bytes, expected %lld\n", got, total);
+	}
+	free(buf);
+	return NULL;
+}
+
+
+// Connects a blocking client socket to a nonblocking server socket
+// over loopback.
+
+static void tcp_pair(int listener, struct sockaddr_in *addr, int *client, int *server)
+{
+	*client = socket(AF_INET, SOCK_STREAM, 0);
+	if(*client < 0 || connect(*client, (struct sockaddr*)addr, sizeof(*addr)) < 0) {
+		perror("connect");
+		exit(1);
+	}
+	*server = accept(listener, NULL, NULL);
+	if(*server < 0 || fcntl(*server, F_SETFL, O_NONBLOCK) < 0) {
+		perror("accept");
+		exit(1);
+	}
+}
+
+
+static double now(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+int main(int argc, char **argv)
+{
+	io_poller poller;
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof(addr);
+	int use_splice = argc > 1 ? strcmp(argv[1], "copy") != 0 : 1;
+	long megs = argc > 2 ? atol(argv[2]) : 2048;
+	int listener, src, dst, in_fd, out_fd, err;
+	pthread_t prod, cons;
+	double start, elapsed, cpu;
+
+	total = (long long)megs * 1024 * 1024;
+
+	err = io_poller_init(&poller, IO_POLLER_EPOLL);
+	if(err) {
+		fprintf(stderr, "couldn't create epoll poller: %s\n", strerror(err));
+		exit(1);
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	if(listener < 0 || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+			listen(listener, 2) < 0 || getsockname(listener, (struct sockaddr*)&addr, &addrlen) < 0) {
+		perror("listen");
+		exit(1);
+	}
+	tcp_pair(listener, &addr, &src, &in_fd);
+	tcp_pair(listener, &addr, &dst, &out_fd);
+	close(listener);
+
+	in_flags = IO_READ;
+	out_flags = 0;
+	if(use_splice) {
+		io_atom_init(&in, in_fd, splice_proc, NULL);
+		io_atom_init(&out, out_fd, NULL, splice_proc);
+		err = io_splice_init(&sp, &in_flags, &out_flags);
+		if(err) {
+			fprintf(stderr, "couldn't create splice: %s\n", strerror(err));
+			exit(1);
+		}
+	} else {
+		io_atom_init(&in, in_fd, copy_read_proc, NULL);
+		io_atom_init(&out, out_fd, NULL, copy_write_proc);
+		io_bufpool_init(&pool, BUF_SIZE, 64);
+		io_outq_init(&in_q, &in, in_flags);
+		io_outq_init(&out_q, &out, out_flags);
+		io_outq_set_watermarks(&out_q, &in_q, HIGH_WATER, LOW_WATER);
+	}
+	io_add(&poller, &in, in_flags);
+	io_add(&poller, &out, out_flags);
+
+	start = now(CLOCK_MONOTONIC);
+	cpu = now(CLOCK_THREAD_CPUTIME_ID);
+	pthread_create(&prod, NULL, producer, &src);
+	pthread_create(&cons, NULL, consumer, &dst);
+	while(!done) {
+		io_wait(&poller, 1000);
+		io_dispatch(&poller);
+	}
+	if(!use_splice) {
+		// the source has closed but the queue may still hold data.
+		while(io_outq_pending(&out_q)) {
+			io_wait(&poller, 1000);
+			io_dispatch(&poller);
+		}
+	}
+	cpu = now(CLOCK_THREAD_CPUTIME_ID) - cpu;
+	io_close(&poller, &in);
+	io_close(&poller, &out);
+	pthread_join(prod, NULL);
+	pthread_join(cons, NULL);
+	elapsed = now(CLOCK_MONOTONIC) - start;
+
+	printf("%s: %lld MB in %.3f s, %.0f MB/s, relay cpu %.3f s (%.2f ns/byte)\n",
+			use_splice ? "splice" : "copy", total / (1024*1024), elapsed,
+			total / (1024*1024) / elapsed, cpu, cpu * 1e9 / total);
+
+	if(use_splice) {
+		io_splice_dispose(&sp);
+	} else {
+		io_outq_dispose(&poller, &out_q);
+		io_outq_dispose(&poller, &in_q);
+		io_bufpool_dispose(&pool);
+	}
+	io_poller_dispose(&poller);
+	return 0;
+}
@@ -0,0 +1,206 @@
+/** @file stream.c
+ *
+ * Completion-style reads and writes.  The native implementation lives
+ * in the poller (see pollers/uring.c); this file holds the generic
+ * routines and the emulation that every other poller uses.
+ */
+
+#include <unistd.h>
+#include <errno.h>
+
+#include "poller.h"
+
+
+// Makes sure the stream's atom is watching for the events that its
+// outstanding requests need.  If force is set, the flags are set even
+// if they haven't changed, to re-arm the edge-triggered pollers.
+
+static int stream_arm(io_poller *poller, io_stream *stream, int flags, int force)
+{
+	int err;
+
+	if(flags == stream->flags && !force) {
+		return 0;
+	}
+
+	err = io_set(poller, &stream->io, flags);
+	if(err) {
+		return err;
+	}
+
+	stream->flags = flags;
+	return 0;
+}
+
+
+static void stream_read_proc(io_poller *poller, io_atom *ioa)
+{
+	io_stream *stream = io_resolve_parent(ioa, io_stream, io);
+	io_request *req = stream->reading;
+	int err;
+
+	if(!req) {
+		// nobody wants the data yet.  stop listening until somebody
+		// does (otherwise the level-triggered pollers would spin).
+		stream_arm(poller, stream, stream->flags & ~IO_READ, 0);
+		return;
+	}
+
+	err = io_read(poller, ioa, req->buf, req->cnt, &req->len);
+	if(err == EAGAIN || err == EWOULDBLOCK) {
+		return;
+	}
+
+	stream->read_full = (req->len == req->cnt);
+	stream->reading = NULL;
+	req->err = err;
+	(*req->proc)(poller, req);
+}
+
+
+static void stream_write_proc(io_poller *poller, io_atom *ioa)
+{
+	io_stream *stream = io_resolve_parent(ioa, io_stream, io);
+	io_request *req = stream->writing;
+	int err;
+
+	if(!req) {
+		stream_arm(poller, stream, stream->flags & ~IO_WRITE, 0);
+		return;
+	}
+
+	err = io_write(poller, ioa, req->buf, req->cnt, &req->len);
+	if(err == EAGAIN || err == EWOULDBLOCK) {
+		return;
+	}
+
+	stream->writing = NULL;
+	req->err = err;
+	(*req->proc)(poller, req);
+}
+
+
+int io_stream_init(io_poller *poller, io_stream *stream, int fd)
+{
+	stream->reading = NULL;
+	stream->writing = NULL;
+	stream->flags = 0;
+	stream->read_full = 0;
+
+	if(io_poller_has(poller, IO_CAP_COMPLETION)) {
+		// the poller talks to the fd directly, the atom is just a handle.
+		io_atom_init(&stream->io, fd, NULL, NULL);
+		return 0;
+	}
+
+	io_atom_init(&stream->io, fd, stream_read_proc, stream_write_proc);
+	return io_add(poller, &stream->io, 0);
+}
+
+
+int io_stream_close(io_poller *poller, io_stream *stream)
+{
+	io_request *rd, *wr;
+	int err;
+
+	rd = stream->reading;
+	wr = stream->writing;
+	stream->reading = NULL;
+	stream->writing = NULL;
+
+	// make sure the poller is done with the requests before handing
+	// them back.  Native pollers may still be using the fd so this
+	// happens before it's closed.
+	if(rd) {
+		io_cancel(poller, rd);
+	}
+	if(wr) {
+		io_cancel(poller, wr);
+	}
+
+	err = io_close(poller, &stream->io);
+
+	if(rd) {
+		rd->len = 0;
+		rd->err = ECANCELED;
+		(*rd->proc)(poller, rd);
+	}
+	if(wr) {
+		wr->len = 0;
+		wr->err = ECANCELED;
+		(*wr->proc)(poller, wr);
+	}
+
+	return err;
+}
+
+
+static int submit(io_poller *poller, io_stream *stream, io_request *req, char *buf, size_t cnt, io_request_proc proc, int is_write)
+{
+	io_request **slot = is_write ? &stream->writing : &stream->reading;
+	int err;
+
+	if(stream->io.fd < 0) {
+		return EBADF;
+	}
+	if(*slot) {
+		return EBUSY;
+	}
+
+	req->proc = proc;
+	req->stream = stream;
+	req->buf = buf;
+	req->cnt = cnt;
+	req->len = 0;
+	req->err = 0;
+	req->is_write = is_write;
+
+	*slot = req;
+	err = io_submit(poller, req);
+	if(err) {
+		*slot = NULL;
+	}
+
+	return err;
+}
+
+
+int io_submit_read(io_poller *poller, io_stream *stream, io_request *req, char *buf, size_t cnt, io_request_proc proc)
+{
+	return submit(poller, stream, req, buf, cnt, proc, 0);
+}
+
+
+int io_submit_write(io_poller *poller, io_stream *stream, io_request *req, const char *buf, size_t cnt, io_request_proc proc)
+{
+	// the buffer is never written to, it's just shared with reads.
+	return submit(poller, stream, req, (char*)buf, cnt, proc, 1);
+}
+
+
+/** Arms the stream's atom so that the request will be satisfied
+ *  from the next readiness event.
+ *
+ *  The edge-triggered pollers won't deliver another event for data
+ *  that was already waiting, so we re-arm if the last read filled its
+ *  buffer (there's probably more) and always for writes (the socket is
+ *  almost always writable already).  Re-arming makes the poller report
+ *  readiness that's already pending.
+ */
+
+int io_stream_emulate_submit(io_poller *poller, io_request *req)
+{
+	io_stream *stream = req->stream;
+
+	if(req->is_write) {
+		return stream_arm(poller, stream, stream->flags | IO_WRITE, 1);
+	}
+
+	return stream_arm(poller, stream, stream->flags | IO_READ, stream->read_full);
+}
+
+
+int io_stream_emulate_cancel(io_poller *poller, io_request *req)
+{
+	return 0;
+}
@@ -0,0 +1,120 @@
+/** @file stream.h
+ *
+ * Completion-style I/O.  Rather than waiting for a readiness event and
+ * then reading, you hand the poller a buffer and it calls you back once
+ * the buffer has been filled (or written).
+ *
+ * Pollers that can do this natively (io_uring) have the kernel fill your
+ * buffer directly.  All other pollers emulate it using readiness events,
+ * so your code doesn't need to change when you switch pollers.  Use
+ * io_poller_has(poller, IO_CAP_COMPLETION) to find out which you got.
+ */
+
+#ifndef IO_STREAM_H
+#define IO_STREAM_H
+
+#include "atom.h"
+
+
+struct io_request;
+struct io_stream;
+
+
+/**
+ * Called when a request completes.  req->err and req->len tell what
+ * happened.  It's fine to submit another request, or to close the
+ * stream, from within this routine.
+ */
+
+typedef void (*io_request_proc)(struct io_poller *poller, struct io_request *req);
+
+
+/**
+ * A single read or write.  Like io_atoms, you allocate these yourself,
+ * probably embedded in a larger structure (use io_resolve_parent to get
+ * back to it).  The request must remain at the same address until its
+ * proc has been called.
+ */
+
+struct io_request {
+	io_request_proc proc;		///< called when the request completes.
+	struct io_stream *stream;	///< the stream this request was submitted on.
+	char *buf;					///< the data to write or the buffer to read into.
+	size_t cnt;					///< the size of buf.
+	size_t len;					///< on completion, the number of bytes transferred.
+	int err;					///< on completion, 0 or an error code, exactly like io_read/io_write.
+	int is_write;				///< nonzero if this is a write request.
+};
+typedef struct io_request io_request;
+
+
+/**
+ * Wraps a file descriptor for completion-style I/O.  There may be
+ * one read and one write outstanding on a stream at any one time.
+ *
+ * Don't call io_add, io_set or io_remove on the stream's atom
+ * yourself; the stream manages that.
+ */
+
+struct io_stream {
+	io_atom io;				///< used by the emulation to receive readiness events.
+	io_request *reading;	///< the outstanding read or NULL.
+	io_request *writing;	///< the outstanding write or NULL.
+	int flags;				///< the flags currently set on io (emulation only).
+	int read_full;			///< the last read filled its buffer so more data may be waiting (emulation only).
+};
+typedef struct io_stream io_stream;
+
+
+/** Prepares a stream to handle requests on the given fd.
+ *  The fd should be nonblocking.
+ */
+
+int io_stream_init(struct io_poller *poller, io_stream *stream, int fd);
+
+
+/** Closes the stream's fd.
+ *
+ * Outstanding requests complete with ECANCELED: their procs are
+ * called before this routine returns.
+ */
+
+int io_stream_close(struct io_poller *poller, io_stream *stream);
+
+
+/** Reads up to cnt bytes into buf.
+ *
+ * proc is called once some data has been read (EPIPE if the remote
+ * closed the connection).  There's no need to read until EAGAIN: you'll
+ * never see EAGAIN at all.
+ *
+ * @returns 0 if the request was submitted, EBUSY if the stream
+ * already has a read outstanding, or another error code.
+ */
+
+int io_submit_read(struct io_poller *poller, io_stream *stream, io_request *req, char *buf, size_t cnt, io_request_proc proc);
+
+
+/** Writes up to cnt bytes from buf.
+ *
+ * Just like write(2), the request may complete with only part of the
+ * buffer written.  Check req->len.
+ */
+
+int io_submit_write(struct io_poller *poller, io_stream *stream, io_request *req, const char *buf, size_t cnt, io_request_proc proc);
+
+
+/** Emulates completions using readiness events.  This is the submit
+ *  routine for every poller that doesn't handle completions natively.
+ */
+
+int io_stream_emulate_submit(struct io_poller *poller, io_request *req);
+
+
+/** The emulation's cancel routine.  Once the stream's slot is cleared
+ *  its atom's events never touch the request so there's nothing to do.
+ */
+
+int io_stream_emulate_cancel(struct io_poller *poller, io_request *req);
+
+#endif
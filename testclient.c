@@ -25,6 +25,8 @@
 
 typedef struct {
 	io_atom io;
+	socket_addr remote;
+	int connecting;		///< set until the nonblocking connect finishes.
 	char c;
 	int chars_processed;
 } connection;
@@ -64,6 +66,26 @@ void connection_read_proc(io_poller *poller, io_atom *ioa)
 
 void connection_write_proc(io_poller *poller, io_atom *ioa)
 {
+	connection *conn = io_resolve_parent(ioa, connection, io);
+	char buf[IO_ADDRSTRLEN];
+	int err;
+
+	if(conn->connecting) {
+		// the connect has finished, one way or the other.
+		conn->connecting = 0;
+		err = io_socket_connect_finish(poller, ioa, IO_READ);
+		if(err) {
+			printf("Could not connect to %s: %s\n",
+				io_addr_format(&conn->remote, buf, sizeof(buf)), strerror(err));
+			io_close(poller, &conn->io);
+			free(conn);
+			return;
+		}
+		printf("Connection opened to %s, given fd %d\n",
+			io_addr_format(&conn->remote, buf, sizeof(buf)), conn->io.fd);
+		return;
+	}
+
 	// This event indicates that space in the write buffer has been
 	// freed up.  You can now continue writing to this fd.
 }
@@ -71,9 +93,13 @@ void connection_write_proc(io_poller *poller, io_atom *ioa)
 
 void create_connection(io_poller *poller, const char *str)
 {
-    socket_addr remote = { { htonl(INADDR_ANY) }, DEFAULT_PORT };
+    socket_addr remote;
 	connection *conn;
-	const char *err;
+	const char *errstr;
+	char buf[IO_ADDRSTRLEN];
+	int err;
+
+	io_addr_any(&remote, DEFAULT_PORT);
 
     conn = malloc(sizeof(connection));
 	if(!conn) {
@@ -81,25 +107,33 @@ void create_connection(io_poller *poller, const char *str)
 		exit(1);
 	}
 
-	err = io_parse_address(str, &remote);
-	if(err) {
-		fprintf(stderr, err, str);
+	errstr = io_parse_address(str, &remote);
+	if(errstr) {
+		fprintf(stderr, errstr, str);
 		exit(1);
 	}
 
-	if(io_connect(poller, &conn->io, connection_read_proc, connection_write_proc, remote, IO_READ)) {
-		perror("connecting to remote");
+	// the connect doesn't block.  If it can't finish right away,
+	// the write proc is called once it does.
+	conn->remote = remote;
+	err = io_connect(poller, &conn->io, connection_read_proc, connection_write_proc, remote, IO_READ);
+	conn->connecting = (err == EINPROGRESS);
+	if(err && err != EINPROGRESS) {
+		fprintf(stderr, "connecting to remote: %s\n", strerror(err));
 		exit(1);
 	}
 
-	printf("Connection opened to %s:%d, given fd %d\n",
-		inet_ntoa(remote.addr), remote.port, conn->io.fd);
+	printf("Connection %s to %s, given fd %d\n",
+		conn->connecting ? "started" : "opened",
+		io_addr_format(&remote, buf, sizeof(buf)), conn->io.fd);
 }
 
 
 int main(int argc, char **argv)
 {
 	io_poller poller;
+	const char *name;
+	int pos = 0, err;
 
 	io_poller_init(&poller, IO_POLLER_ANY);
 	if(!poller.poller_name) {
@@ -108,6 +142,10 @@ int main(int argc, char **argv)
 	}
 
 	printf("Using %s to poll.\n", poller.poller_name);
+	// tell why faster pollers weren't used (old kernel, seccomp, etc).
+	while((name = io_poller_next_rejected(&poller, &pos, &err))) {
+		printf("  (couldn't use %s: %s)\n", name, strerror(err));
+	}
 
 	if(argc == 1) {
 		printf("Specify where to connect, addr:port!\n");
@@ -12,6 +12,7 @@
 // Modify connection_read_proc to change this.
 //   --mock=client to run the mock client tests,
 //   --mock=server to run the mock server tests.
+//   --test=NAME runs the unit tests in testunits.c (--test=all runs them all).
 
 #include <assert.h>
 #include <stdio.h>
@@ -26,6 +27,9 @@
 // set by the command-line options
 int opt_mock_client, opt_mock_server;
 
+// in testunits.c
+int run_unit_tests(const char *name);
+
 
 #define DEFAULT_PORT 6543
 
@@ -242,6 +246,7 @@ void accept_proc(io_poller *poller, io_atom *ioa)
 {
 	connection *conn;
 	socket_addr remote;
+	char buf[IO_ADDRSTRLEN];
 	int err;
 
 	// since the accepter only has IO_READ anyway, there's no need to
@@ -255,22 +260,23 @@ void accept_proc(io_poller *poller, io_atom *ioa)
 
 	err = io_accept(poller, &conn->io, connection_read_proc, connection_write_proc, IO_READ, ioa, &remote);
 	if(err) {
-		fprintf(stderr, "%s while accepting connection from %s:%d\n",
-				 strerror(err), inet_ntoa(remote.addr), remote.port);
+		fprintf(stderr, "%s while accepting connection\n", strerror(err));
+		free(conn);
 		return;
 	}
 
-	printf("Connection opened from %s port %d, given fd %d\n",
-		inet_ntoa(remote.addr), remote.port, conn->io.fd);
+	printf("Connection opened from %s, given fd %d\n",
+		io_addr_format(&remote, buf, sizeof(buf)), conn->io.fd);
 }
 
 
 // given an addr:port string, opens an outgoing connection to that host.
 int initiate_connection(io_poller *poller, const char *str)
 {
-    socket_addr remote = { { htonl(INADDR_ANY) }, DEFAULT_PORT };
+    socket_addr remote;
 	connection *conn;
 	const char *errstr;
+	char buf[IO_ADDRSTRLEN];
 	int err;
 
     conn = malloc(sizeof(connection));
@@ -279,6 +285,7 @@ int initiate_connection(io_poller *poller, const char *str)
 		exit(1);
 	}
 
+	io_addr_any(&remote, DEFAULT_PORT);
 	errstr = io_parse_address(str, &remote);
 	if(errstr) {
 		fprintf(stderr, errstr, str);
@@ -287,13 +294,13 @@ int initiate_connection(io_poller *poller, const char *str)
 
 	err = io_connect(poller, &conn->io, connection_read_proc, connection_write_proc, remote, IO_READ);
 	if(err) {
-		fprintf(stderr, "%s while connecting to %s:%d\n",
-				 strerror(err), inet_ntoa(remote.addr), remote.port);
+		fprintf(stderr, "%s while connecting to %s\n",
+				 strerror(err), io_addr_format(&remote, buf, sizeof(buf)));
 		return -1;
 	}
 
-	printf("Connection opened to %s:%d, given fd %d\n",
-		inet_ntoa(remote.addr), remote.port, conn->io.fd);
+	printf("Connection opened to %s, given fd %d\n",
+		io_addr_format(&remote, buf, sizeof(buf)), conn->io.fd);
 	
 	return 0;
 }
@@ -303,8 +310,9 @@ int initiate_connection(io_poller *poller, const char *str)
 int create_listener(io_poller *poller, const char *str)
 {
 	io_atom *atom;
-	socket_addr sock = { { htonl(INADDR_ANY) }, DEFAULT_PORT };
+	socket_addr sock;
 	const char *errstr;
+	char buf[IO_ADDRSTRLEN];
 	int err;
 
 	atom = malloc(sizeof(io_atom));
@@ -315,6 +323,7 @@ int create_listener(io_poller *poller, const char *str)
 
 	// if a string was supplied, we use it, else we just
 	// use the defaults that are already stored in sock.
+	io_addr_any(&sock, DEFAULT_PORT);
 	if(str) {
 		errstr = io_parse_address(str, &sock);
 		if(errstr) {
@@ -323,15 +332,15 @@ int create_listener(io_poller *poller, const char *str)
 		}
 	}
 
-	err = io_listen(poller, atom, accept_proc, sock);
+	err = io_listen(poller, atom, accept_proc, sock, 0);
 	if(err) {
-		fprintf(stderr, "io_listen on %s:%d failed: %s\n", 
-				inet_ntoa(sock.addr), sock.port, strerror(err));
+		fprintf(stderr, "io_listen on %s failed: %s\n", 
+				io_addr_format(&sock, buf, sizeof(buf)), strerror(err));
 		return -1;
 	}
 	
-	printf("Opened listening socket on %s:%d, fd=%d\n",
-		inet_ntoa(sock.addr), sock.port, atom->fd );
+	printf("Opened listening socket on %s, fd=%d\n",
+		io_addr_format(&sock, buf, sizeof(buf)), atom->fd );
 	
 	return 0;
 }
@@ -404,6 +413,7 @@ static void process_args(io_poller *poller, int argc, char **argv)
 		{"mock", 1, 0, 'm'},
 		{"client", 1, 0, 'c'},
 		{"server", 1, 0, 's'},
+		{"test", 1, 0, 't'},
 		{0, 0, 0, 0},
 	};
 
@@ -438,6 +448,10 @@ static void process_args(io_poller *poller, int argc, char **argv)
 			init_poller(poller, IO_POLLER_ANY);
 			create_listener(poller, optarg);
 			break;
+
+		case 't':
+			// the tests make their own pollers.
+			exit(run_unit_tests(optarg) ? 1 : 0);
 			
 		case '?':
 			// getopt_long already printed the error message
@@ -19,74 +19,105 @@
 #include <arpa/inet.h>
 
 #include "poller.h"
+#include "outq.h"
+#include "bufpool.h"
 
 
 #define DEFAULT_PORT 6543
 
+// Stop reading from a client when this much of its echo is waiting
+// for it to read, start again once it drops to the low mark.
+#define HIGH_WATER 65536
+#define LOW_WATER 16384
 
-typedef struct {
+// Data is read into pooled buffers and queued for output as-is.
+#define READ_BUF_SIZE 16384
+#define BUFS_PER_SLAB 64
+
+static io_bufpool bufpool;
+
+
+typedef struct connection {
 	io_atom io;
+	io_outq outq;
 	char c;
 	int chars_processed;
+	struct connection *next_free;
 } connection;
 
+// Closed connections are kept for reuse so a storm of new connections
+// doesn't mean a storm of mallocs.
+static connection *free_connections;
+
 
-int echo_data(io_poller *poller, connection *conn, const char *readbuf, size_t rlen, size_t *wlen)
+int echo_data(io_poller *poller, connection *conn, io_buf *buf)
 {
 	int err;
 	
-	err = io_write(poller, &conn->io, readbuf, rlen, wlen);
-	printf("wrote %d chars to %d\n", (int)*wlen, conn->io.fd);
-	conn->chars_processed += *wlen;
-	if(rlen < *wlen || err == EAGAIN || err == EWOULDBLOCK) {
-		// When we can't perform a full write, it means that
-		// the remote isn't accepting data fast enough.  To
-		// handle this situation correctly, we would have to
-		// hang onto the unwritten data until an IO_WRITE
-		// event tells us that there's more room for us to
-		// finish the write.  This is an exercise left for
-		// the reader.  :)  (it's not a hard fix, but it
-		// does require a per-connection buffer to store
-		// the unwritten data).
-
-		err = 0; // not a fatal error; we'll just drop the data.
-		// Note that even though we can't write, we continue
-		// reading until the input buffer is exhausted.
-	}
+	// The buffer we read into is queued without copying it.  Whatever
+	// the remote isn't ready to accept is written when it's ready.
+	err = io_buf_queue(poller, &conn->outq, buf);
+	printf("wrote %d chars to %d\n", (int)buf->len, conn->io.fd);
+	conn->chars_processed += buf->len;
 	
 	return err;
 }
 
 
+static void close_connection(io_poller *poller, connection *conn, int err)
+{
+	if(conn->io.fd < 0) {
+		// already closed (io_close sets fd to -1).  Pushing it on
+		// the free list twice would make the list a loop.
+		return;
+	}
+
+	if(err == EPIPE || err == ECONNRESET) {
+		printf("connection closed by remote on fd %d\n",
+			conn->io.fd);
+	} else {
+		printf("error %s on fd %d, closing!\n", strerror(err),
+			conn->io.fd);
+	}
+
+	// close the connection, keep its memory for the next one
+	io_outq_dispose(poller, &conn->outq);
+	io_close(poller, &conn->io);
+	conn->next_free = free_connections;
+	free_connections = conn;
+}
+
+
 void connection_read_proc(io_poller *poller, io_atom *ioa)
 {
 	connection *conn = io_resolve_parent(ioa, connection, io);
-	char readbuf[1024];
+	io_buf *buf;
 	int err;
-    size_t rlen, wlen;
+    size_t rlen;
         
 	do {
-		err = io_read(poller, ioa, readbuf, sizeof(readbuf), &rlen);
-		if(!err) {
-			err = echo_data(poller, conn, readbuf, rlen, &wlen);
-			if(err) break;
+		if(conn->outq.paused) {
+			// too much output is queued.  We'll be called again
+			// once the remote has read some of it.
+			return;
+		}
+		buf = io_buf_alloc(&bufpool);
+		if(!buf) {
+			err = ENOMEM;
+			break;
+		}
+		err = io_buf_read(poller, ioa, buf);
+		rlen = buf->len;
+		if(!err && rlen) {
+			err = echo_data(poller, conn, buf);
 		}
-	} while(rlen);
+		io_buf_unref(buf);
+	} while(!err && rlen);
 	
 	// read and write errors both end up here.  EAGAIN and EWOULDBLOCK
 	// are not errors -- they're a normal part of non-blocking I/O.
 	if(err && err != EAGAIN && err != EWOULDBLOCK) {
-		if(err == EPIPE || err == ECONNRESET) {
-			printf("connection closed by remote on fd %d\n",
-				conn->io.fd);
-		} else {
-			printf("error %s on fd %d, closing!\n", strerror(errno),
-				conn->io.fd);
-		}
-
-		// close the connection, free its memory
-		io_close(poller, &conn->io);
-		free(conn);
+		close_connection(poller, conn, err);
 	}
 
 	// It's true, we perform at least two reads every time data is
@@ -118,33 +149,75 @@ void connection_read_proc(io_poller *poller, io_atom *ioa)
 
 void connection_write_proc(io_poller *poller, io_atom *ioa)
 {
+	connection *conn = io_resolve_parent(ioa, connection, io);
+	int err;
+
+	// the read proc may have closed the connection during this event.
+	if(conn->io.fd < 0) {
+		return;
+	}
+
 	// When this event arrives it indicates that space in the write
 	// buffer has been freed up so continue writing.
+	err = io_outq_flush(poller, &conn->outq);
+	if(err) {
+		close_connection(poller, conn, err);
+	}
 }
 
 
-// called for every incoming connection request
-void accept_proc(io_poller *poller, io_atom *ioa)
+// called by io_socket_accept_all for every new connection
+static void new_connection(io_poller *poller, io_atom *listener, int fd, const socket_addr *remote)
 {
 	connection *conn;
-	socket_addr remote;
-
-	// since the accepter only has IO_READ anyway, there's no need to
-	// check the flags param.
+	char buf[IO_ADDRSTRLEN];
+	int err;
 
-    conn = malloc(sizeof(connection));
-	if(!conn) {
-		perror("allocating connection");
-		return;
+	conn = free_connections;
+	if(conn) {
+		free_connections = conn->next_free;
+	} else {
+		conn = malloc(sizeof(connection));
+		if(!conn) {
+			perror("allocating connection");
+			close(fd);
+			return;
+		}
 	}
 
-	if(io_accept(poller, &conn->io, connection_read_proc, connection_write_proc, IO_READ, ioa, &remote)) {
-		perror("connecting to remote");
+	io_atom_init(&conn->io, fd, connection_read_proc, connection_write_proc);
+	err = io_add(poller, &conn->io, IO_READ);
+	if(err) {
+		fprintf(stderr, "adding connection: %s\n", strerror(err));
+		close(fd);
+		conn->next_free = free_connections;
+		free_connections = conn;
 		return;
 	}
 
-	printf("Connection opened from %s port %d, given fd %d\n",
-		inet_ntoa(remote.addr), remote.port, conn->io.fd);
+	conn->chars_processed = 0;
+	io_outq_init(&conn->outq, &conn->io, IO_READ);
+	io_outq_set_watermarks(&conn->outq, &conn->outq, HIGH_WATER, LOW_WATER);
+
+	printf("Connection opened from %s, given fd %d\n",
+		io_addr_format(remote, buf, sizeof(buf)), conn->io.fd);
+}
+
+
+// called for every incoming connection request
+void accept_proc(io_poller *poller, io_atom *ioa)
+{
+	int err;
+
+	// since the accepter only has IO_READ anyway, there's no need to
+	// check the flags param.
+
+	// We're edge-triggered so, just like reading, we must accept
+	// until there are no more connection requests waiting.
+	err = io_socket_accept_all(poller, ioa, new_connection, NULL);
+	if(err) {
+		fprintf(stderr, "accepting connections: %s\n", strerror(err));
+	}
 }
 
 
@@ -152,7 +225,8 @@ void accept_proc(io_poller *poller, io_atom *ioa)
 void create_listener(io_poller *poller, const char *str)
 {
 	io_atom *atom;
-	socket_addr sock = { { htonl(INADDR_ANY) }, DEFAULT_PORT };
+	socket_addr sock;
+	char buf[IO_ADDRSTRLEN];
 	const char *err;
 
 	atom = malloc(sizeof(io_atom));
@@ -163,6 +237,7 @@ void create_listener(io_poller *poller, const char *str)
 
 	// if a string was supplied, we use it, else we just
 	// use the defaults that are already stored in sock.
+	io_addr_any(&sock, DEFAULT_PORT);
 	if(str) {
 		err = io_parse_address(str, &sock);
 		if(err) {
@@ -176,15 +251,22 @@ void create_listener(io_poller *poller, const char *str)
 		exit(1);
 	}
 	
-	printf("Opened listening socket on %s:%d, fd=%d\n",
-		inet_ntoa(sock.addr), sock.port, atom->fd);
+	printf("Opened listening socket on %s, fd=%d\n",
+		io_addr_format(&sock, buf, sizeof(buf)), atom->fd);
 }
 
 
 int main(int argc, char **argv)
 {
 	io_poller poller;
+	const char *name;
+	int pos = 0, err;
 	
+	if(io_bufpool_init(&bufpool, READ_BUF_SIZE, BUFS_PER_SLAB)) {
+		printf("Could not create the buffer pool!\n");
+		exit(1);
+	}
+
 	io_poller_init(&poller, IO_POLLER_ANY);
 	if(!poller.poller_name) {
 		printf("Could not start a poller!\n");
@@ -192,6 +274,10 @@ int main(int argc, char **argv)
 	}
 
 	printf("Using %s to poll.\n", poller.poller_name);
+	// tell why faster pollers weren't used (old kernel, seccomp, etc).
+	while((name = io_poller_next_rejected(&poller, &pos, &err))) {
+		printf("  (couldn't use %s: %s)\n", name, strerror(err));
+	}
 
 	if(argc == 1) {
 		// if no cmdline args, create default listener
@@ -210,6 +296,7 @@ int main(int argc, char **argv)
 	}
 
 	io_poller_dispose(&poller);
+	io_bufpool_dispose(&bufpool);
 	return 0;
 }
 
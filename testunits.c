@@ -0,0 +1,817 @@
+// testunits.c
+// Scott Bronson
+// 17 Oct 2026
+//
+// Self-checking tests for the library routines that the mock scripts
+// in testmock.c can't reach.  Run them with "testmock --test=all" or
+// name a single test.  Tests that touch the poller are run once on
+// every poller that's compiled in and works on this machine.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "poller.h"
+#include "socket.h"
+#include "outq.h"
+#include "bufpool.h"
+#include "splice.h"
+
+
+static int failures;
+
+#define CHECK(cond) do { \
+	if(!(cond)) { \
+		printf("    %s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+		return; \
+	} \
+} while(0)
+
+
+// Calls io_wait and io_dispatch n times.
+
+static void spin(io_poller *poller, int n, unsigned int timeout)
+{
+	while(n--) {
+		io_wait(poller, timeout);
+		io_dispatch(poller);
+	}
+}
+
+
+static int request_calls;
+static int request_err;
+
+static void count_request(io_poller *poller, io_request *req)
+{
+	request_calls++;
+	request_err = req->err;
+}
+
+
+// Closing a stream completes its outstanding requests with ECANCELED
+// before io_stream_close returns, and nothing touches them afterward.
+
+static void test_stream_close(io_poller *poller)
+{
+	io_stream stream;
+	io_request rd, wr;
+	char buf[4096];
+	int fds[2];
+
+	CHECK(pipe2(fds, O_NONBLOCK) == 0);
+
+	// a read with nothing to read.  The stream gets its own fd so the
+	// pipe stays open after it's closed.
+	request_calls = 0;
+	CHECK(io_stream_init(poller, &stream, dup(fds[0])) == 0);
+	CHECK(io_submit_read(poller, &stream, &rd, buf, sizeof(buf), count_request) == 0);
+	spin(poller, 1, 0);
+	CHECK(request_calls == 0);
+
+	io_stream_close(poller, &stream);
+	CHECK(request_calls == 1);
+	CHECK(request_err == ECANCELED);
+
+	// data arriving later must not be delivered to the closed request.
+	CHECK(write(fds[1], "x", 1) == 1);
+	spin(poller, 3, 10);
+	CHECK(request_calls == 1);
+	close(fds[0]);
+	close(fds[1]);
+
+	// a write into a full pipe
+	CHECK(pipe2(fds, O_NONBLOCK) == 0);
+	memset(buf, 'x', sizeof(buf));
+	while(write(fds[1], buf, sizeof(buf)) > 0)
+		;
+
+	request_calls = 0;
+	CHECK(io_stream_init(poller, &stream, dup(fds[1])) == 0);
+	CHECK(io_submit_write(poller, &stream, &wr, buf, sizeof(buf), count_request) == 0);
+	spin(poller, 1, 0);
+	CHECK(request_calls == 0);
+
+	io_stream_close(poller, &stream);
+	CHECK(request_calls == 1);
+	CHECK(request_err == ECANCELED);
+
+	while(read(fds[0], buf, sizeof(buf)) > 0)
+		;
+	spin(poller, 3, 10);
+	CHECK(request_calls == 1);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+
+//
+// timers
+//
+
+static uint64_t fake_now;
+
+static uint64_t fake_clock(void)
+{
+	return fake_now;
+}
+
+
+struct test_timer {
+	io_timer timer;
+	uint64_t due;		// when it should fire
+	uint64_t fired;		// the wheel's time when it did, or 0
+	int calls;
+};
+
+static uint64_t last_fired;
+static int fired_out_of_order;
+
+static void record_timer(io_poller *poller, io_timer *timer)
+{
+	struct test_timer *t = io_resolve_parent(timer, struct test_timer, timer);
+
+	t->fired = poller->timers->now;
+	t->calls += 1;
+	if(t->fired < last_fired) {
+		fired_out_of_order = 1;
+	}
+	last_fired = t->fired;
+}
+
+
+// Runs the wheel on a fake clock so the level boundaries can be hit
+// exactly.  base sits just past a level 1 boundary, the timers land
+// on both sides of the level 1, 2 and 3 boundaries, and two are due
+// at the very first millisecond of the slot they're cascaded out of.
+
+#define WHEEL_BASE (3*4096 + 10*64 + 3)
+
+static const unsigned int wheel_delays[] = {
+	1, 2, 60, 61, 62, 63, 64, 65, 100,
+	13056 - WHEEL_BASE,		// level 1, due as its slot is cascaded
+	20480 - WHEEL_BASE,		// level 2, due as its slot is cascaded
+	4095, 4096, 4097, 5000, 262144, 262144 + 4096
+};
+#define WHEEL_TIMERS (sizeof(wheel_delays)/sizeof(wheel_delays[0]))
+
+static void start_wheel(io_poller *poller, struct test_timer *timers)
+{
+	io_timer dummy;
+	unsigned int i;
+
+	// the first add allocates the wheel, then it's switched to our clock.
+	io_timer_init(&dummy, NULL);
+	io_timer_add(poller, &dummy, 1000);
+	io_timer_cancel(poller, &dummy);
+	poller->timers->clock = fake_clock;
+
+	fake_now = WHEEL_BASE;
+	last_fired = 0;
+	fired_out_of_order = 0;
+	for(i=0; i<WHEEL_TIMERS; i++) {
+		io_timer_init(&timers[i].timer, record_timer);
+		timers[i].due = WHEEL_BASE + wheel_delays[i];
+		timers[i].fired = 0;
+		timers[i].calls = 0;
+		io_timer_add(poller, &timers[i].timer, wheel_delays[i]);
+	}
+}
+
+
+static void test_timer_wheel(io_poller *poller)
+{
+	struct test_timer timers[WHEEL_TIMERS];
+	uint64_t end = WHEEL_BASE + 262144 + 4096 + 10;
+	unsigned int i, timeout;
+
+	// one millisecond at a time.
+	start_wheel(poller, timers);
+	timeout = io_timer_wheel_timeout(poller->timers, INT_MAX);
+	CHECK(timeout == 1);
+	for(; fake_now <= end; fake_now++) {
+		io_timer_wheel_run(poller, poller->timers);
+	}
+	for(i=0; i<WHEEL_TIMERS; i++) {
+		if(timers[i].calls != 1 || timers[i].fired != timers[i].due) {
+			printf("    timer %u due at %llu fired %d times, last at %llu\n", i,
+				(unsigned long long)timers[i].due, timers[i].calls,
+				(unsigned long long)timers[i].fired);
+		}
+		CHECK(timers[i].calls == 1);
+		CHECK(timers[i].fired == timers[i].due);
+	}
+	CHECK(!fired_out_of_order);
+	CHECK(poller->timers->count == 0);
+
+	// all at once, as if the process had been stopped.
+	start_wheel(poller, timers);
+	fake_now = end;
+	io_timer_wheel_run(poller, poller->timers);
+	for(i=0; i<WHEEL_TIMERS; i++) {
+		CHECK(timers[i].calls == 1);
+		CHECK(timers[i].fired == timers[i].due);
+	}
+	CHECK(!fired_out_of_order);
+
+	// canceled timers never fire and a timer can be re-added from its proc.
+	start_wheel(poller, timers);
+	for(i=0; i<WHEEL_TIMERS; i+=2) {
+		io_timer_cancel(poller, &timers[i].timer);
+	}
+	fake_now = end;
+	io_timer_wheel_run(poller, poller->timers);
+	for(i=0; i<WHEEL_TIMERS; i++) {
+		CHECK(timers[i].calls == (i & 1));
+	}
+	CHECK(poller->timers->count == 0);
+}
+
+
+static uint64_t elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+
+// io_wait never sleeps past the next timer, and a shorter timeout
+// from the caller still wins.
+
+static void test_wait_timeout(io_poller *poller)
+{
+	struct test_timer t;
+	struct timespec start;
+	int i;
+
+	io_timer_init(&t.timer, record_timer);
+	t.calls = 0;
+	last_fired = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	CHECK(io_timer_add(poller, &t.timer, 30) == 0);
+	for(i=0; i<100 && !t.calls; i++) {
+		io_wait(poller, INT_MAX);
+		io_dispatch(poller);
+	}
+	CHECK(t.calls == 1);
+	CHECK(elapsed_ms(&start) >= 29);	// the wheel counts whole ms
+	CHECK(elapsed_ms(&start) < 1000);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	CHECK(io_timer_add(poller, &t.timer, 10000) == 0);
+	io_wait(poller, 20);
+	CHECK(elapsed_ms(&start) < 1000);
+	io_dispatch(poller);
+	CHECK(t.calls == 1);
+	io_timer_cancel(poller, &t.timer);
+
+	// with no timers pending, a 0 timeout doesn't block.
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	io_wait(poller, 0);
+	CHECK(elapsed_ms(&start) < 100);
+}
+
+
+//
+// posts
+//
+
+static char post_log[64];
+static int post_len;
+
+static void log_post(io_poller *poller, void *arg)
+{
+	if(post_len < sizeof(post_log) - 1) {
+		post_log[post_len++] = (char)(intptr_t)arg;
+		post_log[post_len] = '\0';
+	}
+}
+
+
+static void post_more(io_poller *poller, void *arg)
+{
+	log_post(poller, arg);
+	io_poller_post(poller, log_post, (void*)'D');
+	io_poller_post(poller, log_post, (void*)'E');
+}
+
+
+static io_post self_node;
+static int self_reposts;
+
+static void post_self(io_poller *poller, void *arg)
+{
+	log_post(poller, arg);
+	if(self_reposts > 0) {
+		self_reposts -= 1;
+		io_poller_post_node(poller, &self_node, post_self, arg);
+	}
+}
+
+
+#define POST_THREADS 4
+#define POSTS_PER_THREAD 20000
+
+static io_poller *post_poller;
+static int post_next[POST_THREADS];
+static int post_misordered;
+
+static void count_post(io_poller *poller, void *arg)
+{
+	intptr_t n = (intptr_t)arg;
+	int thread = n / POSTS_PER_THREAD;
+
+	if(n % POSTS_PER_THREAD != post_next[thread]) {
+		post_misordered = 1;
+	}
+	post_next[thread] += 1;
+}
+
+
+static void* post_thread(void *arg)
+{
+	intptr_t base = (intptr_t)arg * POSTS_PER_THREAD;
+	int i;
+
+	for(i=0; i<POSTS_PER_THREAD; i++) {
+		io_poller_post(post_poller, count_post, (void*)(base + i));
+	}
+	return NULL;
+}
+
+
+// Posts run in order, and a post made while the queue is draining
+// waits for the next io_dispatch.
+
+static void test_posts(io_poller *poller)
+{
+	pthread_t threads[POST_THREADS];
+	int i, total;
+
+	post_len = 0;
+	io_poller_post(poller, log_post, (void*)'A');
+	io_poller_post(poller, post_more, (void*)'B');
+	io_poller_post(poller, log_post, (void*)'C');
+	spin(poller, 1, 0);
+	CHECK(strcmp(post_log, "ABC") == 0);
+	spin(poller, 1, 0);
+	CHECK(strcmp(post_log, "ABCDE") == 0);
+	spin(poller, 1, 0);
+	CHECK(strcmp(post_log, "ABCDE") == 0);
+
+	// a post that keeps reposting itself runs once per dispatch.
+	post_len = 0;
+	self_reposts = 2;
+	io_poller_post_node(poller, &self_node, post_self, (void*)'x');
+	spin(poller, 4, 0);
+	CHECK(strcmp(post_log, "xxx") == 0);
+
+	// the same when the batch ends at the stub, as it does after a
+	// producer slips in while the stub is being pushed back.
+	post_len = 0;
+	self_reposts = 2;
+	self_node.next = &poller->post_stub;
+	self_node.proc = post_self;
+	self_node.arg = (void*)'y';
+	self_node.allocated = 0;
+	poller->post_stub.next = NULL;
+	poller->post_head = &self_node;
+	poller->post_tail = &poller->post_stub;
+	spin(poller, 1, 0);
+	CHECK(strcmp(post_log, "y") == 0);
+	spin(poller, 3, 0);
+	CHECK(strcmp(post_log, "yyy") == 0);
+
+	// several producer threads: each thread's posts arrive in order.
+	post_poller = poller;
+	post_misordered = 0;
+	for(i=0; i<POST_THREADS; i++) {
+		post_next[i] = 0;
+		pthread_create(&threads[i], NULL, post_thread, (void*)(intptr_t)i);
+	}
+	for(;;) {
+		for(total=0, i=0; i<POST_THREADS; i++) {
+			total += post_next[i];
+		}
+		if(total == POST_THREADS * POSTS_PER_THREAD) {
+			break;
+		}
+		io_wait(poller, 1000);
+		io_dispatch(poller);
+	}
+	for(i=0; i<POST_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	CHECK(!post_misordered);
+}
+
+
+//
+// output queues and buffer pools
+//
+
+static void nop_proc(io_poller *poller, io_atom *atom)
+{
+}
+
+
+// Makes a socketpair with small buffers so the writer fills up fast.
+// The writer, fds[0], is added to the poller as atom.
+
+static int small_socketpair(io_poller *poller, io_atom *atom, int fds[2])
+{
+	int size = 4096;
+
+	if(io_socketpair(SOCK_STREAM, fds)) {
+		return -1;
+	}
+	setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+	setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	io_atom_init(atom, fds[0], nop_proc, nop_proc);
+	return io_add(poller, atom, IO_READ);
+}
+
+
+static void fill_socket(int fd)
+{
+	char buf[4096];
+
+	memset(buf, 0, sizeof(buf));
+	while(write(fd, buf, sizeof(buf)) > 0)
+		;
+}
+
+
+static void empty_socket(int fd)
+{
+	char buf[4096];
+
+	while(read(fd, buf, sizeof(buf)) > 0)
+		;
+}
+
+
+static int chunks_released;
+
+static void count_release(io_outq_chunk *chunk)
+{
+	chunks_released++;
+}
+
+
+#define OUTQ_BYTES (1024*1024)
+#define OUTQ_WRITE 1000
+
+static void test_outq(io_poller *poller)
+{
+	io_atom atom;
+	io_outq q, q2;
+	io_outq_chunk chunks[100];
+	char buf[OUTQ_WRITE], in[4096];
+	int fds[2], i, n, paused = 0, resumed = 0;
+	size_t sent = 0, got = 0;
+
+	CHECK(small_socketpair(poller, &atom, fds) == 0);
+	io_outq_init(&q, &atom, IO_READ);
+	io_outq_set_watermarks(&q, &q, 65536, 16384);
+
+	// queue far more than the socket will take, in many more pieces
+	// than fit in one writev.
+	while(sent < OUTQ_BYTES) {
+		for(i=0; i<OUTQ_WRITE; i++) {
+			buf[i] = (sent + i) % 251;
+		}
+		CHECK(io_outq_write(poller, &q, buf, OUTQ_WRITE) == 0);
+		sent += OUTQ_WRITE;
+		if(q.paused) {
+			paused = 1;
+		}
+	}
+	CHECK(paused);
+	CHECK(q.paused);
+	CHECK(q.flags == IO_WRITE);
+	CHECK(io_outq_pending(&q));
+
+	// the reader takes a little at a time so most writevs are partial.
+	while(got < sent) {
+		n = read(fds[1], in, 1500);
+		if(n > 0) {
+			for(i=0; i<n; i++) {
+				if(in[i] != (char)((got + i) % 251)) {
+					break;
+				}
+			}
+			CHECK(i == n);
+			got += n;
+		}
+		CHECK(io_outq_flush(poller, &q) == 0);
+		if(!q.paused && paused) {
+			CHECK(q.queued <= 16384);
+			CHECK(q.flags & IO_READ);
+			resumed = 1;
+			paused = 0;
+		}
+	}
+	CHECK(resumed);
+	CHECK(q.queued == 0);
+	CHECK(!io_outq_pending(&q));
+	CHECK(q.flags == IO_READ);
+
+	// appended chunks are released once written, or when disposed.
+	chunks_released = 0;
+	fill_socket(fds[0]);
+	for(i=0; i<100; i++) {
+		io_outq_init_chunk(&chunks[i], buf, 10, count_release);
+		CHECK(io_outq_append(poller, &q, &chunks[i]) == 0);
+	}
+	CHECK(q.queued == 1000);
+	CHECK(chunks_released == 0);
+	empty_socket(fds[1]);
+	CHECK(io_outq_flush(poller, &q) == 0);
+	CHECK(chunks_released == 100);
+
+	fill_socket(fds[0]);
+	for(i=0; i<10; i++) {
+		io_outq_init_chunk(&chunks[i], buf, 10, count_release);
+		io_outq_append(poller, &q, &chunks[i]);
+	}
+	io_outq_dispose(poller, &q);
+	CHECK(chunks_released == 110);
+
+	// a disposed queue is forgotten by a peer that points back at it.
+	io_outq_init(&q, &atom, IO_READ);
+	io_outq_init(&q2, &atom, IO_READ);
+	io_outq_set_watermarks(&q, &q2, 65536, 16384);
+	io_outq_set_watermarks(&q2, &q, 65536, 16384);
+	io_outq_dispose(poller, &q);
+	CHECK(q.peer == NULL && q2.peer == NULL);
+	io_outq_dispose(poller, &q2);
+
+	io_remove(poller, &atom);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+
+static void* unref_thread(void *arg)
+{
+	io_buf_unref(arg);
+	return NULL;
+}
+
+
+static void test_bufpool(io_poller *poller)
+{
+	io_bufpool pool;
+	io_atom atom;
+	io_outq q;
+	io_buf *big, *small, *buf;
+	pthread_t thread;
+	char in[8192];
+	int fds[2], n, total;
+
+	CHECK(io_bufpool_init(&pool, 4096, 4) == 0);
+	CHECK(small_socketpair(poller, &atom, fds) == 0);
+	io_outq_init(&q, &atom, IO_READ);
+	fill_socket(fds[0]);
+
+	big = io_buf_alloc(&pool);
+	CHECK(big && big->refs == 1 && big->len == 0);
+	io_buf_ref(big);
+	CHECK(big->refs == 2);
+	io_buf_unref(big);
+	CHECK(big->refs == 1);
+
+	// a queued buffer is held by the queue.
+	memset(big->data, 'b', 3000);
+	big->len = 3000;
+	CHECK(io_buf_queue(poller, &q, big) == 0);
+	CHECK(big->refs == 2 && big->queued);
+	CHECK(io_buf_queue(poller, &q, big) == EBUSY);
+	io_buf_unref(big);
+	CHECK(big->refs == 1);
+
+	// a small one is copied into the end of the queued one.
+	small = io_buf_alloc(&pool);
+	CHECK(small && small != big);
+	memset(small->data, 's', 10);
+	small->len = 10;
+	CHECK(io_buf_queue(poller, &q, small) == 0);
+	CHECK(!small->queued && small->refs == 1);
+	CHECK(q.queued == 3010 && big->len == 3010);
+	io_buf_unref(small);
+
+	// freed buffers are reused, most recent first.
+	buf = io_buf_alloc(&pool);
+	CHECK(buf == small);
+	io_buf_unref(buf);
+
+	// once the data is written the queue drops the last reference.
+	for(total=0; total < 3010; ) {
+		n = read(fds[1], in, sizeof(in));
+		if(n > 0 && in[0] == 0) {
+			continue;	// the filler
+		}
+		if(n > 0) {
+			total += n;
+		}
+		CHECK(io_outq_flush(poller, &q) == 0);
+	}
+	CHECK(!io_outq_pending(&q));
+	buf = io_buf_alloc(&pool);
+	CHECK(buf == big);
+	CHECK(buf->refs == 1 && buf->len == 0 && !buf->queued);
+
+	// the last reference may be dropped on another thread.
+	pthread_create(&thread, NULL, unref_thread, buf);
+	pthread_join(thread, NULL);
+
+	io_outq_dispose(poller, &q);
+	io_remove(poller, &atom);
+	close(fds[0]);
+	close(fds[1]);
+	io_bufpool_dispose(&pool);
+}
+
+
+// Lots of tiny writes each take a page in the pipe, so the pipe runs
+// out of room long before buffered reaches pipe_size.  With dst full,
+// forward must stop reading src instead of spinning on it.
+
+#define SPLICE_WRITES 200
+
+static void test_splice(io_poller *poller)
+{
+	io_atom src, dst;
+	io_splice sp;
+	int src_fds[2], dst_fds[2];
+	int src_flags = IO_READ, dst_flags = 0;
+	char buf[4096];
+	int i, j, n, got = 0, bad = 0;
+
+	CHECK(io_socketpair(SOCK_STREAM, src_fds) == 0);
+	CHECK(small_socketpair(poller, &dst, dst_fds) == 0);
+	io_atom_init(&src, src_fds[0], nop_proc, nop_proc);
+	CHECK(io_add(poller, &src, src_flags) == 0);
+	CHECK(io_set(poller, &dst, dst_flags) == 0);
+	CHECK(io_splice_init(&sp, &src_flags, &dst_flags) == 0);
+	CHECK(sp.pipe_size / 4096 < SPLICE_WRITES);
+
+	// the bytes count up from 1 so they can't be mistaken for filler.
+	for(i=0; i<SPLICE_WRITES; i++) {
+		buf[0] = 1 + i % 250;
+		CHECK(write(src_fds[1], buf, 1) == 1);
+	}
+	fill_socket(dst_fds[0]);
+
+	CHECK(io_splice_forward(poller, &src, &dst, &sp) == 0);
+	CHECK(sp.buffered > 0 && sp.buffered < sp.pipe_size);
+	CHECK(dst_flags & IO_WRITE);
+	CHECK(!(src_flags & IO_READ));
+
+	// now let dst drain and everything should come through in order.
+	for(i=0; i<10000 && got < SPLICE_WRITES; i++) {
+		n = read(dst_fds[1], buf, sizeof(buf));
+		for(j=0; j<n; j++) {
+			if(buf[j] == 0) {
+				continue;
+			}
+			if(buf[j] != (char)(1 + got % 250)) {
+				bad++;
+			}
+			got++;
+		}
+		CHECK(io_splice_forward(poller, &src, &dst, &sp) == 0);
+	}
+	CHECK(got == SPLICE_WRITES);
+	CHECK(!bad);
+	CHECK(sp.buffered == 0);
+	CHECK(src_flags & IO_READ);
+	CHECK(!(dst_flags & IO_WRITE));
+
+	io_splice_dispose(&sp);
+	io_remove(poller, &src);
+	io_remove(poller, &dst);
+	close(src_fds[0]);
+	close(src_fds[1]);
+	close(dst_fds[0]);
+	close(dst_fds[1]);
+}
+
+
+//
+// sockets
+//
+
+static void test_unix_listen(io_poller *poller)
+{
+	io_atom first, second;
+	char path[64];
+	struct stat st;
+	int fd;
+
+	snprintf(path, sizeof(path), "/tmp/io-testunits-%d", (int)getpid());
+	unlink(path);
+
+	// a live listener's socket is left alone.
+	CHECK(io_socket_listen_unix(poller, &first, nop_proc, path, IO_SOCKET_REUSEADDR) == 0);
+	CHECK(io_socket_listen_unix(poller, &second, nop_proc, path, IO_SOCKET_REUSEADDR) == EADDRINUSE);
+	CHECK(lstat(path, &st) == 0 && S_ISSOCK(st.st_mode));
+
+	// once nobody is listening, the socket is stale and gets replaced.
+	io_remove(poller, &first);
+	close(first.fd);
+	CHECK(io_socket_listen_unix(poller, &first, nop_proc, path, 0) == EADDRINUSE);
+	CHECK(io_socket_listen_unix(poller, &second, nop_proc, path, IO_SOCKET_REUSEADDR) == 0);
+	io_remove(poller, &second);
+	close(second.fd);
+	unlink(path);
+
+	// other files are never removed.
+	fd = open(path, O_CREAT|O_WRONLY|O_EXCL, 0600);
+	CHECK(fd >= 0);
+	close(fd);
+	CHECK(io_socket_listen_unix(poller, &first, nop_proc, path, IO_SOCKET_REUSEADDR) == EADDRINUSE);
+	CHECK(lstat(path, &st) == 0 && S_ISREG(st.st_mode));
+	unlink(path);
+}
+
+
+static const io_poller_type all_pollers[] = {
+	IO_POLLER_URING, IO_POLLER_EPOLL, IO_POLLER_POLL, IO_POLLER_SELECT, 0
+};
+
+static const struct {
+	const char *name;
+	void (*proc)(io_poller *poller);
+} tests[] = {
+	{ "stream-close", test_stream_close },
+	{ "timer-wheel", test_timer_wheel },
+	{ "wait-timeout", test_wait_timeout },
+	{ "posts", test_posts },
+	{ "outq", test_outq },
+	{ "bufpool", test_bufpool },
+	{ "splice", test_splice },
+	{ "unix-listen", test_unix_listen },
+	{ NULL, NULL }
+};
+
+
+static void run_test(int n)
+{
+	const io_poller_type *type;
+	io_poller poller;
+	int before;
+
+	for(type=all_pollers; *type; type++) {
+		if(io_poller_init(&poller, *type)) {
+			continue;	// not compiled in or not supported here
+		}
+		before = failures;
+		(*tests[n].proc)(&poller);
+		printf("  %s on %s: %s\n", tests[n].name, poller.poller_name,
+			failures == before ? "ok" : "FAILED");
+		io_poller_dispose(&poller);
+	}
+}
+
+
+/** Runs the named test, or all of them if name is "all".
+ *  Returns the number of failures.
+ */
+
+int run_unit_tests(const char *name)
+{
+	int i, found = 0;
+
+	// the tests close pipes out from under each other.
+	signal(SIGPIPE, SIG_IGN);
+
+	for(i=0; tests[i].name; i++) {
+		if(strcmp(name, "all") == 0 || strcmp(name, tests[i].name) == 0) {
+			run_test(i);
+			found = 1;
+		}
+	}
+
+	if(!found) {
+		fprintf(stderr, "No test named '%s'.\n", name);
+		return 1;
+	}
+
+	return failures;
+}
@@ -0,0 +1,306 @@
+/** @file timer.c
+ *
+ * A hierarchical timing wheel.
+ *
+ * Level 0 has a slot for each of the next 64 milliseconds.  Each slot
+ * on level 1 covers 64 ms, each slot on level 2 covers 4096 ms, and so
+ * on.  A timer is filed on the lowest level that can hold it.  Whenever
+ * a level wraps around, the next slot up is "cascaded": its timers are
+ * re-filed on the lower levels.  Most timers (idle timeouts that keep
+ * getting reset) are canceled long before they're ever cascaded.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+
+#include "poller.h"
+
+
+static uint64_t current_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+static void unlink_timer(io_timer_wheel *wheel, io_timer *timer, int level, int slot)
+{
+	*timer->pprev = timer->next;
+	if(timer->next) {
+		timer->next->pprev = timer->pprev;
+	}
+	timer->next = NULL;
+	timer->pprev = NULL;
+
+	if(!wheel->slots[level][slot]) {
+		wheel->occupied[level] &= ~((uint64_t)1 << slot);
+	}
+}
+
+
+static void link_timer(io_timer_wheel *wheel, io_timer *timer, int level, int slot)
+{
+	io_timer **head = &wheel->slots[level][slot];
+
+	timer->next = *head;
+	if(*head) {
+		(*head)->pprev = &timer->next;
+	}
+	*head = timer;
+	timer->pprev = head;
+	wheel->occupied[level] |= (uint64_t)1 << slot;
+}
+
+
+static void file_timer(io_timer_wheel *wheel, io_timer *timer)
+{
+	uint64_t delta;
+	int level, slot;
+
+	// anything that's already due fires in the next millisecond.
+	if(timer->expires <= wheel->now) {
+		timer->expires = wheel->now + 1;
+	}
+
+	delta = timer->expires - wheel->now;
+	for(level=0; level < IO_TIMER_LEVELS-1; level++) {
+		if(delta < ((uint64_t)1 << (IO_TIMER_BITS * (level+1)))) {
+			break;
+		}
+	}
+
+	if(delta >= ((uint64_t)1 << (IO_TIMER_BITS * IO_TIMER_LEVELS))) {
+		// too far out for the wheel.  file it in the furthest slot
+		// and it'll be re-filed when it comes around.
+		slot = ((wheel->now >> (IO_TIMER_BITS * level)) - 1) & IO_TIMER_MASK;
+	} else {
+		slot = (timer->expires >> (IO_TIMER_BITS * level)) & IO_TIMER_MASK;
+	}
+
+	link_timer(wheel, timer, level, slot);
+}
+
+
+// Unlinks a pending timer in O(1).  We only need to know which slot
+// it's in if it's the only timer there (so the occupied bit must be
+// cleared), and in that case pprev points right at the slot.
+
+static void remove_timer(io_timer_wheel *wheel, io_timer *timer)
+{
+	io_timer **base = &wheel->slots[0][0];
+	io_timer **head = timer->pprev;
+
+	if(timer->next || head < base || head >= base + IO_TIMER_LEVELS*IO_TIMER_SLOTS) {
+		// not the only timer in its slot; the occupied bit stays set.
+		*timer->pprev = timer->next;
+		if(timer->next) {
+			timer->next->pprev = timer->pprev;
+		}
+		timer->next = NULL;
+		timer->pprev = NULL;
+		return;
+	}
+
+	unlink_timer(wheel, timer, (head - base) / IO_TIMER_SLOTS, (head - base) % IO_TIMER_SLOTS);
+}
+
+
+void io_timer_wheel_init(io_timer_wheel *wheel)
+{
+	int level, slot;
+
+	wheel->clock = current_ms;
+	wheel->now = current_ms();
+	wheel->count = 0;
+	for(level=0; level<IO_TIMER_LEVELS; level++) {
+		wheel->occupied[level] = 0;
+		for(slot=0; slot<IO_TIMER_SLOTS; slot++) {
+			wheel->slots[level][slot] = NULL;
+		}
+	}
+}
+
+
+int io_timer_add(io_poller *poller, io_timer *timer, unsigned int ms)
+{
+	io_timer_wheel *wheel = poller->timers;
+
+	if(!wheel) {
+		// most pollers never use timers so the wheel is allocated lazily.
+		wheel = malloc(sizeof(io_timer_wheel));
+		if(!wheel) {
+			return ENOMEM;
+		}
+		io_timer_wheel_init(wheel);
+		poller->timers = wheel;
+	}
+
+	if(io_timer_pending(timer)) {
+		remove_timer(wheel, timer);
+	} else {
+		if(wheel->count == 0) {
+			// the wheel doesn't turn while it's empty, so catch it up.
+			wheel->now = (*wheel->clock)();
+		}
+		wheel->count += 1;
+	}
+
+	timer->expires = (*wheel->clock)() + ms;
+	file_timer(wheel, timer);
+	return 0;
+}
+
+
+int io_timer_cancel(io_poller *poller, io_timer *timer)
+{
+	io_timer_wheel *wheel = poller->timers;
+
+	if(!io_timer_pending(timer)) {
+		return 0;
+	}
+
+	remove_timer(wheel, timer);
+	wheel->count -= 1;
+	return 0;
+}
+
+
+// Re-files all the timers in the given slot on lower levels.
+
+static void cascade(io_timer_wheel *wheel, int level, int slot)
+{
+	io_timer *timer = wheel->slots[level][slot];
+	io_timer *next;
+
+	wheel->slots[level][slot] = NULL;
+	wheel->occupied[level] &= ~((uint64_t)1 << slot);
+
+	for(; timer; timer = next) {
+		next = timer->next;
+		timer->next = NULL;
+		timer->pprev = NULL;
+		if(timer->expires <= wheel->now) {
+			// due right at the start of the slot's span.  The level 0
+			// slot for now is expired right after cascading so it
+			// fires on time (file_timer would push it a tick later).
+			link_timer(wheel, timer, 0, wheel->now & IO_TIMER_MASK);
+		} else {
+			file_timer(wheel, timer);
+		}
+	}
+}
+
+
+// Fires every timer in the given level 0 slot.
+
+static void expire(io_poller *poller, io_timer_wheel *wheel, int slot)
+{
+	io_timer *timer;
+
+	// pop them one at a time because a proc may cancel other timers
+	while((timer = wheel->slots[0][slot])) {
+		unlink_timer(wheel, timer, 0, slot);
+		if(timer->expires > wheel->now) {
+			// a timer too far out for the wheel, it just came around.
+			file_timer(wheel, timer);
+			continue;
+		}
+		wheel->count -= 1;
+		(*timer->proc)(poller, timer);
+	}
+}
+
+
+// Returns the number of milliseconds past wheel->now until the next
+// slot that has timers needs attention (either to fire or to cascade).
+
+static uint64_t next_event(io_timer_wheel *wheel)
+{
+	uint64_t best = UINT64_MAX;
+	uint64_t bits, rot, unit, when;
+	int level, idx, k;
+
+	for(level=0; level<IO_TIMER_LEVELS; level++) {
+		bits = wheel->occupied[level];
+		if(!bits) {
+			continue;
+		}
+
+		// rotate so bit 0 is the slot after the current one.
+		idx = (wheel->now >> (IO_TIMER_BITS * level)) & IO_TIMER_MASK;
+		idx = (idx + 1) & IO_TIMER_MASK;
+		rot = idx ? (bits >> idx) | (bits << (IO_TIMER_SLOTS - idx)) : bits;
+		k = __builtin_ctzll(rot) + 1;
+
+		unit = (uint64_t)1 << (IO_TIMER_BITS * level);
+		when = k * unit - (wheel->now & (unit - 1));
+		if(when < best) {
+			best = when;
+		}
+	}
+
+	return best;
+}
+
+
+/** Returns the timeout that io_wait should use: the lesser of the
+ *  caller's timeout and the time until the next timer needs service.
+ */
+
+unsigned int io_timer_wheel_timeout(io_timer_wheel *wheel, unsigned int timeout)
+{
+	uint64_t next, late;
+
+	if(wheel->count == 0) {
+		return timeout;
+	}
+
+	next = next_event(wheel);
+	late = (*wheel->clock)() - wheel->now;
+	next = next > late ? next - late : 0;
+
+	return next < timeout ? (unsigned int)next : timeout;
+}
+
+
+/** Fires all timers that have expired. */
+
+void io_timer_wheel_run(io_poller *poller, io_timer_wheel *wheel)
+{
+	uint64_t target, step;
+	int level, idx;
+
+	if(wheel->count == 0) {
+		return;
+	}
+
+	target = (*wheel->clock)();
+	while(wheel->now < target) {
+		if(wheel->count == 0) {
+			wheel->now = target;
+			break;
+		}
+
+		// skip straight to the next slot that needs attention.
+		step = next_event(wheel);
+		if(step > target - wheel->now) {
+			wheel->now = target;
+			break;
+		}
+		wheel->now += step;
+
+		// when a level wraps, cascade the next level up.
+		for(level=1; level<IO_TIMER_LEVELS; level++) {
+			if(wheel->now & (((uint64_t)1 << (IO_TIMER_BITS * level)) - 1)) {
+				break;
+			}
+			idx = (wheel->now >> (IO_TIMER_BITS * level)) & IO_TIMER_MASK;
+			cascade(wheel, level, idx);
+		}
+
+		expire(poller, wheel, wheel->now & IO_TIMER_MASK);
+	}
+}
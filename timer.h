@@ -0,0 +1,87 @@
+/** @file timer.h
+ *
+ * Timers that fire from io_dispatch.
+ *
+ * Like io_atoms, you allocate io_timers yourself, probably embedded in
+ * the same structure as the atom.  Adding and canceling a timer are both
+ * O(1) and neither allocates, so it's fine to give every connection an
+ * idle timer and reset it on every read.
+ *
+ * The timers are kept in a hierarchical timing wheel (see Varghese and
+ * Lauck, "Hashed and Hierarchical Timing Wheels").  Resolution is one
+ * millisecond.  io_wait never sleeps past the next timer.
+ */
+
+#ifndef IO_TIMER_H
+#define IO_TIMER_H
+
+#include <stdint.h>
+
+
+struct io_poller;
+struct io_timer;
+
+
+/** Called when the timer expires.  The timer is no longer pending so
+ *  it's fine to re-add it (or free it) from this routine.
+ */
+
+typedef void (*io_timer_proc)(struct io_poller *poller, struct io_timer *timer);
+
+
+struct io_timer {
+	struct io_timer *next;		///< next timer in the same wheel slot.
+	struct io_timer **pprev;	///< points at whatever points to us, NULL if not pending.
+	io_timer_proc proc;			///< the function to call when the timer expires.
+	uint64_t expires;			///< when the timer expires, in milliseconds.
+};
+typedef struct io_timer io_timer;
+
+
+#define IO_TIMER_BITS 6
+#define IO_TIMER_SLOTS (1 << IO_TIMER_BITS)
+#define IO_TIMER_MASK (IO_TIMER_SLOTS - 1)
+
+/// Each level covers 64 times the span of the level below it.  5 levels
+/// cover 2^30 ms (12 days).  Timers further out than that get re-filed
+/// when they reach the top level.
+#define IO_TIMER_LEVELS 5
+
+
+struct io_timer_wheel {
+	uint64_t (*clock)(void);			///< returns the current time in ms.  Tests may replace it.
+	uint64_t now;						///< the last millisecond that has been processed.
+	unsigned int count;					///< the number of pending timers.
+	uint64_t occupied[IO_TIMER_LEVELS];	///< bit n is set if slot n on that level has timers.
+	io_timer *slots[IO_TIMER_LEVELS][IO_TIMER_SLOTS];
+};
+typedef struct io_timer_wheel io_timer_wheel;
+
+
+/** Ensures that you've fully initialized an io_timer (see io_atom_init). */
+#define io_timer_init(t,pp)  ((t)->next=NULL,(t)->pprev=NULL,(t)->proc=(pp),(t)->expires=0)
+
+/** Nonzero if the timer is scheduled to fire. */
+#define io_timer_pending(t)  ((t)->pprev != NULL)
+
+
+/** Arranges for the timer's proc to be called in ms milliseconds.
+ *  If the timer is already pending, it's rescheduled.  Returns ENOMEM
+ *  if the poller's timer wheel couldn't be allocated (first add only).
+ */
+
+int io_timer_add(struct io_poller *poller, io_timer *timer, unsigned int ms);
+
+
+/** Cancels the timer.  It's fine to cancel a timer that isn't pending. */
+
+int io_timer_cancel(struct io_poller *poller, io_timer *timer);
+
+
+// These are called by the poller, you shouldn't need them.
+
+void io_timer_wheel_init(io_timer_wheel *wheel);
+unsigned int io_timer_wheel_timeout(io_timer_wheel *wheel, unsigned int timeout);
+void io_timer_wheel_run(struct io_poller *poller, io_timer_wheel *wheel);
+
+#endif
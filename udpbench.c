@@ -0,0 +1,177 @@
+// udpbench.c
+//
+// Blasts 1200 byte datagrams over loopback for a few seconds and
+// reports how many packets per second were sent and received, with
+// and without segmentation offload:
+//
+//     off   64 datagrams per io_send_batch, one per io_datagram
+//     gso   the same packets, 40 per io_datagram with segment set
+//     gro   gso plus io_socket_udp_gro on the receiver
+//
+// The sender runs in its own thread; the receiver drains its socket
+// with io_recv_batch from a read proc.
+//
+//     make udpbench
+//     ./udpbench [seconds]
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "poller.h"
+
+
+#define PKT_SIZE 1200
+#define SEGMENTS 40			// per GSO datagram: 48000 bytes
+#define SEND_BATCH 64
+#define RECV_BATCH 64
+#define RECV_SIZE 65536
+#define PORT 36123
+
+enum { MODE_OFF, MODE_GSO, MODE_GRO };
+static const char *mode_names[] = { "off", "gso", "gro" };
+
+static int mode;
+static volatile int running;
+static long long sent_pkts, recv_pkts;
+static char *recv_bufs;
+
+
+static void* sender(void *arg)
+{
+	socket_addr remote;
+	io_datagram d[SEND_BATCH];
+	char *buf = calloc(1, PKT_SIZE * SEGMENTS);
+	io_poller poller;
+	io_atom atom;
+	int i, n, err, cnt;
+
+	io_poller_init(&poller, IO_POLLER_EPOLL);
+	io_addr_ipv4(&remote, htonl(INADDR_LOOPBACK), PORT);
+	err = io_socket_udp_connect(&poller, &atom, NULL, NULL, remote, 0);
+	if(err) {
+		fprintf(stderr, "sender: %s\n", strerror(err));
+		exit(1);
+	}
+
+	// offload sends fewer, bigger datagrams for the same packets.
+	cnt = mode == MODE_OFF ? SEND_BATCH : (SEND_BATCH + SEGMENTS - 1) / SEGMENTS;
+	for(i=0; i<cnt; i++) {
+		d[i].buf = buf;
+		d[i].len = mode == MODE_OFF ? PKT_SIZE : PKT_SIZE * SEGMENTS;
+		d[i].segment = mode == MODE_OFF ? 0 : PKT_SIZE;
+		io_addr_set_port(&d[i].addr, 0);	// the connected peer
+	}
+
+	while(running) {
+		err = io_send_batch(&poller, &atom, d, cnt, &n);
+		if(err == EAGAIN || err == ENOBUFS) {
+			sched_yield();
+			continue;
+		}
+		if(err) {
+			fprintf(stderr, "send: %s\n", strerror(err));
+			exit(1);
+		}
+		sent_pkts += mode == MODE_OFF ? n : (long long)n * SEGMENTS;
+	}
+
+	io_close(&poller, &atom);
+	io_poller_dispose(&poller);
+	free(buf);
+	return NULL;
+}
+
+
+static void receive_proc(io_poller *poller, io_atom *atom)
+{
+	io_datagram d[RECV_BATCH];
+	int i, n;
+
+	for(i=0; i<RECV_BATCH; i++) {
+		d[i].buf = recv_bufs + i*RECV_SIZE;
+		d[i].size = RECV_SIZE;
+	}
+
+	while(io_recv_batch(poller, atom, d, RECV_BATCH, &n) == 0) {
+		for(i=0; i<n; i++) {
+			// a coalesced datagram holds len/segment packets, rounded up.
+			recv_pkts += d[i].segment ? (d[i].len + d[i].segment - 1) / d[i].segment : 1;
+		}
+	}
+}
+
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void run(int m, double seconds)
+{
+	socket_addr local;
+	io_poller poller;
+	io_atom atom;
+	pthread_t thread;
+	double start, elapsed;
+	int err, rcvbuf = 8*1024*1024;
+
+	mode = m;
+	sent_pkts = recv_pkts = 0;
+
+	io_poller_init(&poller, IO_POLLER_EPOLL);
+	io_addr_ipv4(&local, htonl(INADDR_LOOPBACK), PORT);
+	err = io_socket_udp_bind(&poller, &atom, receive_proc, NULL, local, IO_SOCKET_REUSEADDR);
+	if(err) {
+		fprintf(stderr, "bind: %s\n", strerror(err));
+		exit(1);
+	}
+	setsockopt(atom.fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	if(mode == MODE_GRO) {
+		err = io_socket_udp_gro(&atom, 1);
+		if(err) {
+			fprintf(stderr, "gro: %s\n", strerror(err));
+			exit(1);
+		}
+	}
+
+	running = 1;
+	pthread_create(&thread, NULL, sender, NULL);
+	start = now();
+	while((elapsed = now() - start) < seconds) {
+		io_wait(&poller, 100);
+		io_dispatch(&poller);
+	}
+	running = 0;
+	pthread_join(thread, NULL);
+
+	printf("%s: sent %.0f pkts/s, received %.0f pkts/s (%.0f%%)\n", mode_names[mode],
+			sent_pkts / elapsed, recv_pkts / elapsed,
+			sent_pkts ? 100.0 * recv_pkts / sent_pkts : 0.0);
+
+	io_close(&poller, &atom);
+	io_poller_dispose(&poller);
+}
+
+
+int main(int argc, char **argv)
+{
+	double seconds = argc > 1 ? atof(argv[1]) : 2;
+
+	recv_bufs = malloc(RECV_BATCH * RECV_SIZE);
+	run(MODE_OFF, seconds);
+	run(MODE_GSO, seconds);
+	run(MODE_GRO, seconds);
+	free(recv_bufs);
+	return 0;
+}
@@ -0,0 +1,243 @@
+// zcbench.c
+//
+// Sends a stream over a loopback TCP connection with plain io_write
+// and with io_write_zc, at a range of write sizes, and reports the
+// throughput and the sender's CPU time for each.  A consumer thread
+// reads the other end.
+//
+//     make zcbench
+//     ./zcbench [megabytes per run]
+//
+// Zerocopy trades the copy for page pinning and a completion to
+// process, so it only wins once writes are large.  Be warned that
+// loopback can't really do zerocopy: the receiver needs its own copy,
+// so the kernel copies anyway and reports it ("copied" below).  Over a
+// real NIC the crossover is typically somewhere past 10KB per write.
+// Run it between two machines for numbers that mean something.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "poller.h"
+#include "bufpool.h"
+#include "zerocopy.h"
+
+
+static io_poller poller;
+static io_atom out;
+static io_zc zc;
+static io_bufpool pool;
+static char *plain;
+
+static int use_zc;
+static size_t msg_size;
+static long long total, sent;
+static io_buf *cur;
+static size_t off;
+static int starved, failed;
+
+
+static void pump(io_poller *poller)
+{
+	size_t len;
+	int err;
+
+	while(sent < total) {
+		if(use_zc) {
+			if(!cur) {
+				cur = io_buf_alloc(&pool);
+				if(!cur) {
+					failed = ENOMEM;
+					return;
+				}
+				cur->len = msg_size;
+			}
+			err = io_write_zc_buf(poller, &out, &zc, cur, off, &len);
+		} else {
+			err = io_write(poller, &out, plain + off, msg_size - off, &len);
+		}
+
+		if(err) {
+			if(err == ENOBUFS) {
+				// too much memory pinned.  Wait for completions.
+				starved = 1;
+			} else if(err != EAGAIN) {
+				failed = err;
+			}
+			return;
+		}
+
+		off += len;
+		sent += len;
+		if(off == msg_size) {
+			if(cur) {
+				io_buf_unref(cur);
+				cur = NULL;
+			}
+			off = 0;
+		}
+	}
+}
+
+
+static void write_proc(io_poller *poller, io_atom *atom)
+{
+	pump(poller);
+}
+
+
+static void error_proc(io_poller *poller, io_atom *atom)
+{
+	int err = io_zc_complete(poller, &zc);
+	if(err) {
+		failed = err;
+	}
+	if(starved) {
+		starved = 0;
+		pump(poller);
+	}
+}
+
+
+static void* consumer(void *arg)
+{
+	int fd = *(int*)arg;
+	char *buf = malloc(1024*1024);
+	long long got = 0;
+	ssize_t len;
+
+	while((len = read(fd, buf, 1024*1024)) > 0) {
+		got += len;
+	}
+	if(got != total) {
+		fprintf(stderr, "consumer got %lld bytes, expected %lld\n", got, total);
+	}
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+
+static double now(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+// Sends total bytes in writes of size msg and prints the results.
+
+static void run(int listener, struct sockaddr_in *addr, int zerocopy, size_t msg)
+{
+	int client, server, err;
+	pthread_t cons;
+	double start, cpu, elapsed;
+
+	use_zc = zerocopy;
+	msg_size = msg;
+	sent = 0;
+	off = 0;
+	starved = 0;
+	failed = 0;
+
+	client = socket(AF_INET, SOCK_STREAM, 0);
+	if(client < 0 || connect(client, (struct sockaddr*)addr, sizeof(*addr)) < 0) {
+		perror("connect");
+		exit(1);
+	}
+	server = accept(listener, NULL, NULL);
+	if(server < 0 || fcntl(server, F_SETFL, O_NONBLOCK) < 0) {
+		perror("accept");
+		exit(1);
+	}
+
+	io_atom_init(&out, server, NULL, write_proc);
+	if(use_zc) {
+		err = io_zc_init(&poller, &out, &zc, NULL);
+		if(err) {
+			fprintf(stderr, "zerocopy unavailable: %s\n", strerror(err));
+			exit(1);
+		}
+		io_atom_set_error_proc(&out, error_proc);
+		io_bufpool_init(&pool, msg, 64);
+	}
+	io_add(&poller, &out, IO_WRITE);
+
+	pthread_create(&cons, NULL, consumer, &client);
+	start = now(CLOCK_MONOTONIC);
+	cpu = now(CLOCK_THREAD_CPUTIME_ID);
+
+	pump(&poller);
+	while(!failed && (sent < total || (use_zc && io_zc_busy(&zc)))) {
+		io_wait(&poller, 1000);
+		io_dispatch(&poller);
+	}
+
+	cpu = now(CLOCK_THREAD_CPUTIME_ID) - cpu;
+	io_close(&poller, &out);
+	pthread_join(cons, NULL);
+	elapsed = now(CLOCK_MONOTONIC) - start;
+
+	if(failed) {
+		fprintf(stderr, "send failed: %s\n", strerror(failed));
+		exit(1);
+	}
+
+	printf("%8s %7zu: %6.0f MB/s, sender cpu %.3f s%s\n",
+			use_zc ? "zerocopy" : "write", msg, total / (1024*1024) / elapsed,
+			cpu, use_zc && zc.copied ? " (copied)" : "");
+
+	if(use_zc) {
+		io_zc_dispose(&zc);
+		io_bufpool_dispose(&pool);
+	}
+}
+
+
+int main(int argc, char **argv)
+{
+	static const size_t sizes[] = { 4096, 16384, 65536, 262144, 1048576 };
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof(addr);
+	long megs = argc > 1 ? atol(argv[1]) : 1024;
+	int listener, err, i;
+
+	total = (long long)megs * 1024 * 1024;
+
+	err = io_poller_init(&poller, IO_POLLER_EPOLL);
+	if(err) {
+		fprintf(stderr, "couldn't create epoll poller: %s\n", strerror(err));
+		exit(1);
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	if(listener < 0 || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+			listen(listener, 2) < 0 || getsockname(listener, (struct sockaddr*)&addr, &addrlen) < 0) {
+		perror("listen");
+		exit(1);
+	}
+
+	plain = calloc(1, sizes[sizeof(sizes)/sizeof(sizes[0]) - 1]);
+	for(i=0; i<sizeof(sizes)/sizeof(sizes[0]); i++) {
+		run(listener, &addr, 0, sizes[i]);
+		run(listener, &addr, 1, sizes[i]);
+	}
+
+	free(plain);
+	close(listener);
+	io_poller_dispose(&poller);
+	return 0;
+}
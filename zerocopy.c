@@ -0,0 +1,240 @@
+/** @file zerocopy.c
+ *
+ * MSG_ZEROCOPY sends and their completions.  See zerocopy.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#include "poller.h"
+#include "zerocopy.h"
+
+#if defined(__linux__) && defined(MSG_ZEROCOPY)
+
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+
+
+int io_zc_init(io_poller *poller, io_atom *io, io_zc *zc, io_zc_proc proc)
+{
+	int one = 1;
+
+	zc->atom = io;
+	zc->proc = proc;
+	zc->next_seq = 0;
+	zc->copied = 0;
+	zc->pending = NULL;
+	zc->head = 0;
+	zc->count = 0;
+	zc->size = 0;
+
+	if(!io_poller_has(poller, IO_CAP_ERROR_PROC)) {
+		return ENOTSUP;
+	}
+	if(setsockopt(io->fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0) {
+		return errno ? errno : -1;
+	}
+	return 0;
+}
+
+
+void io_zc_dispose(io_zc *zc)
+{
+	while(zc->count) {
+		io_buf_unref(zc->pending[zc->head].buf);
+		zc->head = (zc->head + 1) & (zc->size - 1);
+		zc->count -= 1;
+	}
+	free(zc->pending);
+	zc->pending = NULL;
+	zc->size = 0;
+}
+
+
+int io_write_zc(io_poller *poller, io_atom *io, io_zc *zc, const char *buf, size_t cnt, size_t *wrlen)
+{
+	ssize_t len;
+
+	*wrlen = 0;
+	do {
+		len = send(io->fd, buf, cnt, MSG_ZEROCOPY | MSG_NOSIGNAL);
+	} while(len < 0 && errno == EINTR);
+
+	if(len > 0) {
+		// the kernel only numbers sends that sent something.
+		zc->next_seq += 1;
+		*wrlen = len;
+		return 0;
+	}
+
+	if(len < 0) {
+#if EAGAIN != EWOULDBLOCK
+		if(errno == EWOULDBLOCK) errno = EAGAIN;
+#endif
+		return errno ? errno : -1;
+	}
+
+	return 0;
+}
+
+
+// Doubles the ring, unwrapping it so the oldest entry is first.
+
+static int grow_pending(io_zc *zc)
+{
+	unsigned size = zc->size ? zc->size * 2 : 16;
+	struct io_zc_pending *ring;
+	unsigned i;
+
+	ring = malloc(size * sizeof(*ring));
+	if(!ring) {
+		return ENOMEM;
+	}
+	for(i=0; i<zc->count; i++) {
+		ring[i] = zc->pending[(zc->head + i) & (zc->size - 1)];
+	}
+
+	free(zc->pending);
+	zc->pending = ring;
+	zc->head = 0;
+	zc->size = size;
+	return 0;
+}
+
+
+int io_write_zc_buf(io_poller *poller, io_atom *io, io_zc *zc, io_buf *buf, size_t off, size_t *wrlen)
+{
+	struct io_zc_pending *p;
+	int err;
+
+	// make room first: once the kernel has the buffer we must track it.
+	if(zc->count == zc->size) {
+		err = grow_pending(zc);
+		if(err) {
+			*wrlen = 0;
+			return err;
+		}
+	}
+
+	err = io_write_zc(poller, io, zc, buf->data + off, buf->len - off, wrlen);
+	if(err || !*wrlen) {
+		return err;
+	}
+
+	p = &zc->pending[(zc->head + zc->count) & (zc->size - 1)];
+	p->seq = zc->next_seq - 1;
+	p->buf = buf;
+	io_buf_ref(buf);
+	zc->count += 1;
+
+	return 0;
+}
+
+
+// Releases buffers whose sends are at or before hi.  TCP completes
+// sends in order so they're always at the front of the ring.
+
+static void release_through(io_zc *zc, uint32_t hi)
+{
+	struct io_zc_pending *p;
+
+	while(zc->count) {
+		p = &zc->pending[zc->head];
+		if((int32_t)(p->seq - hi) > 0) {
+			break;
+		}
+		io_buf_unref(p->buf);
+		zc->head = (zc->head + 1) & (zc->size - 1);
+		zc->count -= 1;
+	}
+}
+
+
+int io_zc_complete(io_poller *poller, io_zc *zc)
+{
+	char control[128];
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	struct sock_extended_err *serr;
+	int copied, err = 0;
+
+	for(;;) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if(recvmsg(zc->atom->fd, &msg, MSG_ERRQUEUE) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			if(errno != EAGAIN && errno != EWOULDBLOCK && !err) {
+				err = errno;
+			}
+			break;
+		}
+
+		for(cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			if(!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+					(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+				continue;
+			}
+			serr = (struct sock_extended_err*)CMSG_DATA(cm);
+			if(serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+				if(!err) {
+					err = serr->ee_errno;
+				}
+				continue;
+			}
+
+			// ee_info through ee_data is the range of completed sends.
+			copied = (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0;
+			if(copied) {
+				zc->copied = 1;
+			}
+			release_through(zc, serr->ee_data);
+			if(zc->proc) {
+				(*zc->proc)(poller, zc, serr->ee_info, serr->ee_data, copied);
+			}
+		}
+	}
+
+	return err;
+}
+
+#else
+
+int io_zc_init(struct io_poller *poller, io_atom *io, io_zc *zc, io_zc_proc proc)
+{
+	memset(zc, 0, sizeof(*zc));
+	zc->atom = io;
+	return ENOSYS;
+}
+
+
+void io_zc_dispose(io_zc *zc)
+{
+}
+
+
+int io_write_zc(struct io_poller *poller, io_atom *io, io_zc *zc, const char *buf, size_t cnt, size_t *wrlen)
+{
+	*wrlen = 0;
+	return ENOSYS;
+}
+
+
+int io_write_zc_buf(struct io_poller *poller, io_atom *io, io_zc *zc, io_buf *buf, size_t off, size_t *wrlen)
+{
+	*wrlen = 0;
+	return ENOSYS;
+}
+
+
+int io_zc_complete(struct io_poller *poller, io_zc *zc)
+{
+	return 0;
+}
+
+#endif
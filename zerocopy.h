@@ -0,0 +1,118 @@
+/** @file zerocopy.h
+ *
+ * Sends with MSG_ZEROCOPY.
+ *
+ * A zerocopy send pins your buffer and lets the NIC read it directly
+ * instead of copying it into the kernel.  The catch is that you can't
+ * touch the buffer until the kernel says it's done with it.  It says
+ * so by queueing a notification on the socket's error queue, which
+ * the poller reports to the atom's error_proc.  Call io_zc_complete
+ * from there.
+ *
+ * Every io_write_zc that sends something is given a sequence number,
+ * counting up from 0.  Notifications cover a range of them.  If you
+ * send io_bufs with io_write_zc_buf the bookkeeping is done for you:
+ * each buffer holds a reference until its sends have completed.
+ *
+ *		io_zc_init(poller, &conn->io, &conn->zc, NULL);
+ *		io_atom_set_error_proc(&conn->io, conn_error_proc);
+ *		...
+ *		err = io_write_zc_buf(poller, &conn->io, &conn->zc, buf, 0, &len);
+ *		io_buf_unref(buf);		// freed once the kernel is done with it
+ *		...
+ *		// in conn_error_proc
+ *		err = io_zc_complete(poller, &conn->zc);
+ *
+ * Zerocopy only pays off for large writes (tens of KB and up) since
+ * pinning pages and handling notifications has a cost of its own.  If
+ * the kernel had to copy the data anyway (loopback, or a NIC that
+ * can't scatter-gather) it sets zc->copied and you may as well go
+ * back to io_write.  See zcbench.c.
+ */
+
+#ifndef IO_ZEROCOPY_H
+#define IO_ZEROCOPY_H
+
+#include <stdint.h>
+#include "atom.h"
+#include "bufpool.h"
+
+
+struct io_zc;
+
+/** Called by io_zc_complete when sends lo through hi (inclusive) have
+ *  completed.  copied is set if the kernel copied the data after all.
+ */
+
+typedef void (*io_zc_proc)(struct io_poller *poller, struct io_zc *zc, uint32_t lo, uint32_t hi, int copied);
+
+
+/// An io_buf waiting for its send to complete.
+struct io_zc_pending {
+	uint32_t seq;
+	io_buf *buf;
+};
+
+
+struct io_zc {
+	io_atom *atom;
+	io_zc_proc proc;				///< may be NULL.
+	uint32_t next_seq;				///< the sequence number the next send will be given.
+	int copied;						///< set once the kernel reports it copied instead.
+
+	struct io_zc_pending *pending;	///< a ring of buffers waiting for completions, oldest first.
+	unsigned head;					///< the index of the oldest pending buffer.
+	unsigned count;					///< the number of pending buffers.
+	unsigned size;					///< the ring's capacity, always a power of two.
+};
+typedef struct io_zc io_zc;
+
+
+/** Nonzero while any sends are waiting to complete. */
+#define io_zc_busy(zc) ((zc)->count != 0)
+
+
+/** Turns on SO_ZEROCOPY for the atom's socket.
+ *
+ * @returns 0, ENOTSUP if the poller can't deliver completions
+ * (no IO_CAP_ERROR_PROC), or the setsockopt error (ENOPROTOOPT on
+ * kernels without MSG_ZEROCOPY).  Fall back to io_write on failure.
+ */
+
+int io_zc_init(struct io_poller *poller, io_atom *io, io_zc *zc, io_zc_proc proc);
+
+
+/** Drops the references held on any buffers still waiting.  Call this
+ *  after closing the socket, once you no longer care whether data
+ *  still in flight arrives intact.
+ */
+
+void io_zc_dispose(io_zc *zc);
+
+
+/** Writes like io_write but with MSG_ZEROCOPY.  buf must not be
+ *  modified or freed until the send's sequence number (zc->next_seq
+ *  before the call) has completed.  ENOBUFS means too much is
+ *  pinned: wait for completions.
+ */
+
+int io_write_zc(struct io_poller *poller, io_atom *io, io_zc *zc, const char *buf, size_t cnt, size_t *wrlen);
+
+
+/** Sends buf->data from offset off with io_write_zc, holding a
+ *  reference on buf until the kernel has finished with it.
+ */
+
+int io_write_zc_buf(struct io_poller *poller, io_atom *io, io_zc *zc, io_buf *buf, size_t off, size_t *wrlen);
+
+
+/** Reads the socket's error queue, releasing completed buffers and
+ *  calling the zc's proc.  Call this from the atom's error_proc.
+ *
+ * @returns 0, or the first error found on the queue that wasn't a
+ * zerocopy notification (an ICMP error, say).
+ */
+
+int io_zc_complete(struct io_poller *poller, io_zc *zc);
+
+#endif